@@ -0,0 +1,115 @@
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+/*********************************************************************
+ *                                                                   *
+ *                            operations                             *
+ *                                                                   *
+ *********************************************************************/
+
+/***************
+ * arena_alloc *
+ ***************/
+
+/* NULL only if malloc fails, blocks double so resets settle quickly */
+
+void*
+arena_alloc(struct arena* arena, size_t size)
+{
+    struct arena_block* block;
+    size_t off, cap;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+    block = arena->head;
+
+    if (block == NULL || arena->used + size > block->cap) {
+        cap = block ? block->cap * 2 : ARENA_BLOCK;
+        while (cap < size)
+            cap *= 2;
+
+        block = malloc(sizeof(struct arena_block) + cap);
+        if (block == NULL)
+            return NULL;
+
+        block->next = arena->head;
+        block->cap = cap;
+        arena->head = block;
+        arena->used = 0;
+    }
+
+    off = arena->used;
+    arena->used += size;
+    arena->last = off;
+
+    return block->data + off;
+}
+
+/**************
+ * arena_grow *
+ **************/
+
+/* 
+ * resizes ptr, of old bytes, to size, the latest allocation grows in
+ * place when its block has room, anything else moves
+ */
+
+void*
+arena_grow(struct arena* arena, void* ptr, size_t old, size_t size)
+{
+    struct arena_block* block;
+    void* data;
+
+    block = arena->head;
+
+    if (ptr != NULL && ptr == block->data + arena->last &&
+        arena->last + size <= block->cap) {
+        size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+        arena->used = arena->last + size;
+        return ptr;
+    }
+
+    data = arena_alloc(arena, size);
+    if (data != NULL && ptr != NULL)
+        memcpy(data, ptr, old < size ? old : size);
+
+    return data;
+}
+
+/***************
+ * arena_reset *
+ ***************/
+
+/* the newest block is the largest, it alone is kept */
+
+void
+arena_reset(struct arena* arena)
+{
+    struct arena_block *block, *next;
+
+    if (arena->head == NULL)
+        return;
+
+    block = arena->head->next;
+    while (block != NULL) {
+        next = block->next;
+        free(block);
+        block = next;
+    }
+
+    arena->head->next = NULL;
+    arena->used = 0;
+    arena->last = 0;
+}
+
+/**************
+ * arena_free *
+ **************/
+
+void
+arena_free(struct arena* arena)
+{
+    arena_reset(arena);
+    free(arena->head);
+    arena->head = NULL;
+}
@@ -0,0 +1,51 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+#define ARENA_BLOCK    (16 * 1024)
+#define ARENA_ALIGN    16
+
+/*********************************************************************
+ *                                                                   *
+ *                        struct definitions                         *
+ *                                                                   *
+ *********************************************************************/
+
+/***************
+ * arena_block *
+ ***************/
+
+struct arena_block {
+    struct arena_block* next;               /* older, smaller blocks */
+    size_t cap;
+    _Alignas(ARENA_ALIGN) char data[];
+};
+
+/*********
+ * arena *
+ *********/
+
+/* 
+ * bump allocator, nothing is freed on its own, a reset drops
+ * everything at once and keeps the newest block for the next round
+ */
+
+struct arena {
+    struct arena_block* head;               /* allocations come from here */
+    size_t used;
+    size_t last;                            /* offset of latest allocation */
+};
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+void* arena_alloc(struct arena* arena, size_t size);
+void* arena_grow(struct arena* arena, void* ptr, size_t old, size_t size);
+void arena_reset(struct arena* arena);
+void arena_free(struct arena* arena);
+
+#endif    /* ARENA_H */
@@ -0,0 +1,509 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "bundle.h"
+
+/*********************************************************************
+ *                                                                   *
+ *                           global data                             *
+ *                                                                   *
+ *********************************************************************/
+
+struct bundle bundle = { .fd = -1 };
+
+/*********************************************************************
+ *                                                                   *
+ *                              packing                              *
+ *                                                                   *
+ *********************************************************************/
+
+/*****************
+ * bundle_string *
+ *****************/
+
+/* writes str with its NUL at *off, the offset it landed at */
+
+uint32_t
+bundle_string(FILE* fp, char* str, uint64_t* off)
+{
+    uint32_t at;
+    size_t len;
+
+    at = *off;
+    len = strlen(str) + 1;
+    fwrite(str, 1, len, fp);
+    *off += len;
+
+    return at;
+}
+
+/****************
+ * bundle_write *
+ ****************/
+
+/*
+ * loads every route of the view the usual way, variants and all, and
+ * writes them to fp as one bundle, the table goes in last once every
+ * offset is known so fp has to seek
+ */
+
+int
+bundle_write(FILE* fp)
+{
+    struct bundle_head head;
+    struct bundle_entry* entries;
+    struct bundle_entry* entry;
+    struct file *file, *version;
+    uint64_t off;
+
+    entries = calloc(n_routes, sizeof(struct bundle_entry));
+    if (entries == NULL)
+        return -1;
+
+    off = sizeof(struct bundle_head) + n_routes * sizeof(struct bundle_entry);
+    fseek(fp, off, SEEK_SET);
+
+    for (int i = 0; i < n_routes; i++) {
+        entries[i].resource_off = bundle_string(fp, view[i].resource, &off);
+        entries[i].page_off = bundle_string(fp, view[i].page, &off);
+        entries[i].type = view[i].type;
+    }
+
+    for (int i = 0; i < n_routes; i++) {
+        file = file_load(&view[i], 1);
+        if (file == NULL) {
+            free(entries);
+            return -1;
+        }
+
+        entry = &entries[i];
+        entry->mtime = file->mtime;
+        memcpy(entry->last_modified, file->last_modified, DATE_LEN + 1);
+
+        for (int enc = 0; enc < N_ENCODINGS; enc++) {
+            version = enc == ENC_IDENTITY ? file : file->variants[enc];
+            if (version == NULL)
+                continue;
+
+            /* a seek past the end leaves the padding zeroed */
+
+            off = (off + BUNDLE_ALIGN - 1) & ~(uint64_t)(BUNDLE_ALIGN - 1);
+            fseek(fp, off, SEEK_SET);
+
+            entry->data_off[enc] = off;
+            entry->size[enc] = version->size;
+            memcpy(entry->etag[enc], version->etag, ETAG_LEN + 1);
+
+            fwrite(version->data, 1, version->size, fp);
+            off += version->size;
+
+            if (enc == ENC_IDENTITY) {
+                fputc(0, fp);
+                off++;
+            }
+        }
+
+        file_put(file);
+    }
+
+    memset(&head, 0, sizeof(struct bundle_head));
+    memcpy(head.magic, BUNDLE_MAGIC, sizeof(head.magic));
+    head.n_entries = n_routes;
+
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&head, sizeof(struct bundle_head), 1, fp);
+    fwrite(entries, sizeof(struct bundle_entry), n_routes, fp);
+    fseek(fp, 0, SEEK_END);
+
+    free(entries);
+
+    return ferror(fp) ? -1 : 0;
+}
+
+/***************
+ * bundle_pack *
+ ***************/
+
+int
+bundle_pack(char* path)
+{
+    FILE* fp;
+    char* tmp;
+    int err;
+
+    /*
+     * a running server may have the old bundle mapped, so write a new
+     * file and rename it into place instead of truncating that one
+     */
+
+    if (asprintf(&tmp, "%s.tmp", path) < 0)
+        return -1;
+
+    fp = fopen(tmp, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "[ERROR] fopen %s: %s\n", tmp, strerror(errno));
+        free(tmp);
+        return -1;
+    }
+
+    err = bundle_write(fp) < 0;
+    err |= fflush(fp) != 0;
+    err |= fsync(fileno(fp)) != 0;
+    err |= fclose(fp) != 0;
+
+    if (err || rename(tmp, path) < 0) {
+        fprintf(stderr, "[ERROR] writing %s failed\n", path);
+        unlink(tmp);
+        free(tmp);
+        return -1;
+    }
+
+    free(tmp);
+    return 0;
+}
+
+/****************
+ * bundle_embed *
+ ****************/
+
+/*
+ * writes the bundle as C source defining bundle_embedded, compiling it
+ * in with -DEMBED gives a server that reads nothing from disk
+ */
+
+int
+bundle_embed(char* path)
+{
+    FILE *tmp, *fp;
+    long n;
+    int c;
+
+    tmp = tmpfile();
+    if (tmp == NULL || bundle_write(tmp) < 0) {
+        fprintf(stderr, "[ERROR] packing for %s failed\n", path);
+        if (tmp)
+            fclose(tmp);
+        return -1;
+    }
+
+    fp = fopen(path, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "[ERROR] fopen %s: %s\n", path, strerror(errno));
+        fclose(tmp);
+        return -1;
+    }
+
+    fprintf(fp, "/* generated by server -e, do not edit */\n\n"
+                "#include <stddef.h>\n"
+                "#include <stdint.h>\n\n"
+                "const uint8_t bundle_embedded[] "
+                "__attribute__((aligned(%d))) = {", BUNDLE_ALIGN);
+
+    rewind(tmp);
+    for (n = 0; (c = fgetc(tmp)) != EOF; n++)
+        fprintf(fp, "%s0x%02x,", n % 12 ? " " : "\n    ", c);
+
+    fprintf(fp, "\n};\n\n"
+                "const size_t bundle_embedded_len = %ld;\n", n);
+
+    fclose(tmp);
+
+    if (ferror(fp) | fclose(fp)) {
+        fprintf(stderr, "[ERROR] writing %s failed\n", path);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                              serving                              *
+ *                                                                   *
+ *********************************************************************/
+
+/***************
+ * bundle_fits *
+ ***************/
+
+/* whether [off, off + len) lies inside the bundle */
+
+int
+bundle_fits(uint64_t off, uint64_t len)
+{
+    return off <= bundle.size && len <= bundle.size - off;
+}
+
+/**************
+ * bundle_str *
+ **************/
+
+/* the NUL terminated string at off, NULL if it runs off the end */
+
+char*
+bundle_str(uint32_t off)
+{
+    if (off >= bundle.size ||
+        memchr(bundle.data + off, 0, bundle.size - off) == NULL)
+        return NULL;
+
+    return (char*)bundle.data + off;
+}
+
+/****************
+ * bundle_index *
+ ****************/
+
+/*
+ * checks the table of the bundle in bundle.data and swaps its routes
+ * in for the view, nothing in the table is trusted until it has been
+ * bounds checked here
+ */
+
+int
+bundle_index()
+{
+    struct bundle_head* head;
+    struct bundle_entry* entries;
+    struct route* routes;
+    uint32_t n;
+
+    head = (struct bundle_head*)bundle.data;
+
+    if (bundle.size < sizeof(*head) ||
+        memcmp(head->magic, BUNDLE_MAGIC, sizeof(head->magic)) != 0)
+        return -1;
+
+    n = head->n_entries;
+    if (n == 0 || !bundle_fits(sizeof(*head),
+                               (uint64_t)n * sizeof(struct bundle_entry)))
+        return -1;
+
+    entries = (struct bundle_entry*)(bundle.data + sizeof(*head));
+    routes = calloc(n, sizeof(struct route));
+    if (routes == NULL)
+        return -1;
+
+    for (uint32_t i = 0; i < n; i++) {
+        for (int enc = 0; enc < N_ENCODINGS; enc++) {
+            if (enc != ENC_IDENTITY && entries[i].data_off[enc] == 0)
+                continue;
+            if (!bundle_fits(entries[i].data_off[enc],
+                             (uint64_t)entries[i].size[enc] +
+                             (enc == ENC_IDENTITY)) ||
+                memchr(entries[i].etag[enc], 0, ETAG_LEN + 1) == NULL)
+                goto corrupt;
+
+            /* error pages are used as strings, identity data ends in a NUL */
+
+            if (enc == ENC_IDENTITY &&
+                bundle.data[entries[i].data_off[enc] +
+                            entries[i].size[enc]] != 0)
+                goto corrupt;
+        }
+
+        if (memchr(entries[i].last_modified, 0, DATE_LEN + 1) == NULL ||
+            mime_to_str(entries[i].type) == NULL)
+            goto corrupt;
+
+        routes[i].resource = bundle_str(entries[i].resource_off);
+        routes[i].page = bundle_str(entries[i].page_off);
+        if (routes[i].resource == NULL || routes[i].page == NULL)
+            goto corrupt;
+
+        routes[i].type = entries[i].type;
+        routes[i].entry = &entries[i];
+    }
+
+    bundle.routes = routes;
+    view = routes;
+    n_routes = n;
+
+    return 0;
+
+corrupt:
+    free(routes);
+    return -1;
+}
+
+/***************
+ * bundle_open *
+ ***************/
+
+/*
+ * maps a bundle made by bundle_pack and serves its routes, one open
+ * and one mmap however many pages it holds, the pages themselves
+ * fault in as they are first served
+ */
+
+int
+bundle_open(char* path)
+{
+    struct stat st;
+
+    bundle.fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (bundle.fd < 0) {
+        fprintf(stderr, "[ERROR] open %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(bundle.fd, &st) < 0 || st.st_size == 0) {
+        fprintf(stderr, "[ERROR] %s is not a bundle\n", path);
+        bundle_close();
+        return -1;
+    }
+
+    bundle.size = st.st_size;
+    bundle.data = mmap(NULL, bundle.size, PROT_READ, MAP_SHARED, bundle.fd, 0);
+    if (bundle.data == MAP_FAILED) {
+        fprintf(stderr, "[ERROR] mmap %s: %s\n", path, strerror(errno));
+        bundle.data = NULL;
+        bundle_close();
+        return -1;
+    }
+
+    if (bundle_index() < 0) {
+        fprintf(stderr, "[ERROR] %s is not a valid bundle\n", path);
+        bundle_close();
+        return -1;
+    }
+
+    return 0;
+}
+
+/*****************
+ * bundle_attach *
+ *****************/
+
+/*
+ * serves a bundle already in memory, such as one compiled in, there is
+ * no descriptor so big bodies go out from data itself
+ */
+
+int
+bundle_attach(const uint8_t* data, size_t size)
+{
+    bundle.data = (uint8_t*)data;
+    bundle.size = size;
+    bundle.fd = -1;
+
+    if (bundle_index() < 0) {
+        fprintf(stderr, "[ERROR] the embedded bundle is not valid\n");
+        bundle.data = NULL;
+        return -1;
+    }
+
+    return 0;
+}
+
+/***************
+ * bundle_file *
+ ***************/
+
+/* a version over one encoding of an entry, its bytes stay in the bundle */
+
+struct file*
+bundle_file(struct bundle_entry* entry, enum encoding enc)
+{
+    struct file* file;
+
+    file = calloc(1, sizeof(struct file));
+    if (file == NULL)
+        return NULL;
+
+    file->data = bundle.data + entry->data_off[enc];
+    file->size = entry->size[enc];
+    file->fd = bundle.fd;
+    file->fd_off = entry->data_off[enc];
+    file->bundled = 1;
+    file->encoding = enc;
+    file->mtime = entry->mtime;
+    memcpy(file->last_modified, entry->last_modified, DATE_LEN + 1);
+    memcpy(file->etag, entry->etag[enc], ETAG_LEN + 1);
+    atomic_init(&file->refs, 1);
+
+    return file;
+}
+
+/***************
+ * bundle_load *
+ ***************/
+
+/* 
+ * a fresh version of a bundled route with one ref, nothing is read or
+ * hashed, only the heads are built
+ */
+
+struct file*
+bundle_load(struct route* route)
+{
+    struct bundle_entry* entry;
+    struct file* file;
+
+    entry = route->entry;
+
+    file = bundle_file(entry, ENC_IDENTITY);
+    if (file == NULL)
+        return NULL;
+
+    for (int enc = ENC_GZIP; enc < N_ENCODINGS; enc++) {
+        if (entry->data_off[enc] == 0)
+            continue;
+
+        file->variants[enc] = bundle_file(entry, enc);
+        if (file->variants[enc] == NULL ||
+            file_head(file->variants[enc], route->type) < 0) {
+            file_put(file);
+            return NULL;
+        }
+    }
+
+    if (file_head(file, route->type) < 0 ||
+        (route->type == TEXT_HTML && template_compile(file) < 0)) {
+        file_put(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                            destructors                            *
+ *                                                                   *
+ *********************************************************************/
+
+/****************
+ * bundle_close *
+ ****************/
+
+/* after view_free, the routes and every version point into the bundle */
+
+void
+bundle_close()
+{
+    if (bundle.routes != NULL && view == bundle.routes) {
+        view = NULL;
+        n_routes = 0;
+    }
+
+    /* only a bundle opened from a file is mapped */
+
+    free(bundle.routes);
+    if (bundle.data != NULL && bundle.fd >= 0)
+        munmap(bundle.data, bundle.size);
+
+    if (bundle.fd >= 0)
+        close(bundle.fd);
+
+    bundle.routes = NULL;
+    bundle.data = NULL;
+    bundle.fd = -1;
+}
@@ -0,0 +1,90 @@
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <stdint.h>
+#include "http.h"
+
+#define BUNDLE_MAGIC    "HRBUNDL1"
+#define BUNDLE_ALIGN    8                   /* of every blob */
+
+/*********************************************************************
+ *                                                                   *
+ *                        struct definitions                         *
+ *                                                                   *
+ *********************************************************************/
+
+/***************
+ * bundle_head *
+ ***************/
+
+/*
+ * starts the bundle, n_entries entries follow it and then the strings
+ * and blobs they point at, offsets are from the start of the bundle
+ */
+
+struct bundle_head {
+    char magic[8];
+    uint32_t n_entries;
+    uint32_t pad;
+};
+
+/****************
+ * bundle_entry *
+ ****************/
+
+/*
+ * one route with every encoding of its page, a variant that was not
+ * worth keeping has a data_off of 0, identity data is NUL terminated
+ */
+
+struct bundle_entry {
+    uint32_t resource_off;                  /* NUL terminated strings */
+    uint32_t page_off;
+    uint32_t type;                          /* enum mime_type */
+    uint32_t pad;
+    int64_t mtime;
+
+    uint64_t data_off[N_ENCODINGS];
+    uint32_t size[N_ENCODINGS];
+
+    char last_modified[DATE_LEN + 1];       /* precomputed validators */
+    char etag[N_ENCODINGS][ETAG_LEN + 1];
+};
+
+/**********
+ * bundle *
+ **********/
+
+/* 
+ * an open bundle, mapped once or compiled in, and kept for the life of
+ * the process
+ */
+
+struct bundle {
+    uint8_t* data;
+    size_t size;
+    int fd;
+    struct route* routes;                   /* the view while it is open */
+};
+
+extern struct bundle bundle;
+
+#ifdef EMBED
+extern const uint8_t bundle_embedded[];     /* generated by server -e */
+extern const size_t bundle_embedded_len;
+#endif
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+int bundle_pack(char* path);
+int bundle_embed(char* path);
+int bundle_open(char* path);
+int bundle_attach(const uint8_t* data, size_t size);
+struct file* bundle_load(struct route* route);
+void bundle_close();
+
+#endif    /* BUNDLE_H */
@@ -1,15 +1,40 @@
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
 #include <time.h>
 #include <sys/mman.h>
+#include <strings.h>
+#include <ctype.h>
 #include <errno.h>
+#include <stdatomic.h>
+#include <dirent.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/random.h>
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <zlib.h>
+#include <brotli/encode.h>
 #include "http.h"
+#include "rcu.h"
+#include "arena.h"
+#include "scan.h"
+#include "bundle.h"
 
 #define MAX_DATE_LEN        200
-#define MAX_BUF_LEN         500
-#define MAX_POST_ENTRIES    20
+#define DATE_SLOTS          4
+#define MAX_CONTENT_LEN     (1 << 30)
+#define MAX_HEADER_LEN      512
+#define WATCH_BUF_LEN       4096
+#define RECLAIM_MS          1000
+#define COMPRESS_MIN        256             /* smaller bodies go as they are */
+#define MAP_MIN             SENDFILE_MIN    /* smaller pages are read in */
+#define HUGE_PAGE           (2 * 1024 * 1024)
+#define BOUNDARY_LEN        24              /* hex digits, 96 random bits */
 
 /*********************************************************************
  *                                                                   *
@@ -17,9 +42,15 @@
  *                                                                   *
  *********************************************************************/
 
-struct post_entry {
-    char key[MAX_BUF_LEN];
-    char val[MAX_BUF_LEN];
+struct header_name {
+    char* name;
+    int len;
+    enum header_id id;
+};
+
+struct mime_ext {
+    char* ext;
+    enum mime_type type;
 };
 
 /*********************************************************************
@@ -28,119 +59,169 @@ struct post_entry {
  *                                                                   *
  *********************************************************************/
 
-struct route view[] = {
-    { .resource = "/",              .page = "/index.html",    .file = { }, .type = TEXT_HTML },
-    { .resource = "/login.html",    .page = "/login.html",    .file = { }, .type = TEXT_HTML },
-    { .resource = "/webserver.png", .page = "/webserver.png", .file = { }, .type = IMAGE_PNG },
-    { .resource = "/style/background.css", .page = "/style/background.css", .file = { }, .type = TEXT_CSS },
-    { .resource = "/4xx.html",      .page = "/4xx.html",      .file = {},  .type = TEXT_HTML }
+struct route view_default[] = {
+    { .resource = "/",              .page = "/index.html",    .type = TEXT_HTML },
+    { .resource = "/login.html",    .page = "/login.html",    .type = TEXT_HTML },
+    { .resource = "/webserver.png", .page = "/webserver.png", .type = IMAGE_PNG },
+    { .resource = "/style/background.css", .page = "/style/background.css", .type = TEXT_CSS },
+    { .resource = "/4xx.html",      .page = "/4xx.html",      .type = TEXT_HTML }
 };
 
-const char* view_loc  = "pages";
-const char* date_fmt  = "%a, %d %b %Y %H:%M:%S %Z";
-const char* resp_fmt  = "HTTP/1.0 %d %s\r\n"          /* status line */
-                        "Content-Type: %s\r\n"        /* headers */
-                        "Content-Length: %zu\r\n"
-                        "Date: %s\r\n"
-                        "\r\n";                       /* CRLF */
+/* the hardcoded pages unless view_discover swaps in the whole tree */
+
+struct route* view = view_default;
+int n_routes = sizeof(view_default) / sizeof(struct route);
+int view_cap = 0;                 /* nonzero once view is discovered */
+int view_huge = 0;                /* map large pages on huge pages */
+long view_budget = 0;             /* bytes of pages to keep, 0 is all */
+
+struct mime_ext mime_exts[] = {
+    { ".html",  TEXT_HTML },
+    { ".htm",   TEXT_HTML },
+    { ".css",   TEXT_CSS },
+    { ".txt",   TEXT_PLAIN },
+    { ".js",    TEXT_JS },
+    { ".png",   IMAGE_PNG },
+    { ".jpg",   IMAGE_JPEG },
+    { ".jpeg",  IMAGE_JPEG },
+    { ".gif",   IMAGE_GIF },
+    { ".svg",   IMAGE_SVG },
+    { ".ico",   IMAGE_ICON },
+    { ".webp",  IMAGE_WEBP },
+    { ".json",  APP_JSON },
+    { ".pdf",   APP_PDF },
+    { ".woff2", FONT_WOFF2 }
+};
 
-/*********************************************************************
- *                                                                   *
- *                              utility                              *
- *                                                                   *
- *********************************************************************/
+/* every known header by name, matched without regard to case */
+
+const struct header_name header_names[] = {
+    { "Host",              4,  HDR_HOST },
+    { "Range",             5,  HDR_RANGE },
+    { "Accept",            6,  HDR_ACCEPT },
+    { "Cookie",            6,  HDR_COOKIE },
+    { "Referer",           7,  HDR_REFERER },
+    { "If-Range",          8,  HDR_IF_RANGE },
+    { "Connection",        10, HDR_CONNECTION },
+    { "User-Agent",        10, HDR_USER_AGENT },
+    { "Content-Type",      12, HDR_CONTENT_TYPE },
+    { "If-None-Match",     13, HDR_IF_NONE_MATCH },
+    { "Content-Length",    14, HDR_CONTENT_LENGTH },
+    { "Accept-Encoding",   15, HDR_ACCEPT_ENCODING },
+    { "If-Modified-Since", 17, HDR_IF_MODIFIED_SINCE },
+    { "Transfer-Encoding", 17, HDR_TRANSFER_ENCODING },
+};
+int n_header_names = sizeof(header_names) / sizeof(struct header_name);
 
-/***********
- * is_crlf *
- ***********/
+/* uri -> route, built from view by router_init */
 
-int
-is_crlf(char* a)
-{
-    return a[0] == '\r' && a[1] == '\n';
-}
+struct route_slot* routes;
+uint32_t routes_mask;
+struct route* error_route;
 
-/********
- * skip *
- ********/
+/* replaced file versions waiting out a grace period */
 
-void
-skip(char** data)
-{
-    while (**data == ' ' && **data != 0)
-        (*data)++;
-}
+struct file* _Atomic retired;
 
-/***************
- * end_of_line *
- ***************/
+/* 
+ * the multipart/byteranges delimiter, random per process so a page
+ * would have to hold it by a 1 in 2^96 chance to break a response
+ */
 
-/* skips until the end of the line */
+char boundary[BOUNDARY_LEN + 1];
 
-void
-end_of_line(char** data)
-{
-    while (**data != '\r' && **data != 0)
-        (*data)++;
-}
+/* bytes of published versions, and the tick eviction ranks hits by */
 
-/**************
- * parse_word *
- **************/
+atomic_long view_bytes;
+atomic_uint view_clock;
 
-/* fills buf with a keyword, moves data to whitespace after */
+const char* view_loc  = "pages";
+const char* error_fmt = "<html><body><h1>Request Error</h1>"
+                        "<h3>%d: %s</h3></body></html>";
+const char* date_fmt  = "%a, %d %b %Y %H:%M:%S GMT";
+char* date_blank      = "Thu, 01 Jan 1970 00:00:00 GMT";
+
+/*
+ * the current Date value, date_update renders into the slot after the
+ * live one and then publishes it, so a reader would have to stall for
+ * DATE_SLOTS - 1 seconds mid copy to ever see a slot being rewritten
+ */
+
+char date_slots[DATE_SLOTS][MAX_DATE_LEN];
+atomic_int date_cur;
+const char* head_fmt  = "HTTP/1.1 %d %s\r\n"          /* status line */
+                        "Content-Type: %s\r\n"        /* headers */
+                        "Content-Length: %d\r\n"
+                        "Date: %s\r\n";               /* Date goes last */
+const char* file_fmt  = "HTTP/1.1 200 OK\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %d\r\n"
+                        "%s%s"                        /* encoding, vary */
+                        "ETag: %s\r\n"
+                        "Last-Modified: %s\r\n"
+                        "Date: %s\r\n";
+const char* nm_fmt    = "HTTP/1.1 304 Not Modified\r\n"
+                        "%s"                          /* vary */
+                        "ETag: %s\r\n"
+                        "Last-Modified: %s\r\n"
+                        "Date: %s\r\n";
+const char* vary_line = "Vary: Accept-Encoding\r\n";
+const char* range_fmt = "HTTP/1.1 %d %s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Length: %d\r\n"
+                        "%s"                          /* Content-Range */
+                        "ETag: %s\r\n"
+                        "Last-Modified: %s\r\n"
+                        "Date: %s\r\n";
+const char* part_fmt  = "\r\n--%s\r\n"
+                        "Content-Type: %s\r\n"
+                        "Content-Range: bytes %d-%d/%d\r\n\r\n";
+
+/* Content-Encoding line and sibling suffix per encoding */
+
+const char* enc_lines[N_ENCODINGS] = {
+    "",
+    "Content-Encoding: gzip\r\n",
+    "Content-Encoding: br\r\n"
+};
 
-void
-parse_word(char** data, char* buf)
-{
-    while (**data != ' ' && **data != '\r' && **data != 0) {
-        *buf = **data;
-        (*data)++;
-        buf++;
-    }
+const char* enc_exts[N_ENCODINGS] = { "", ".gz", ".br" };
+const char* months    = "JanFebMarAprMayJunJulAugSepOctNovDec";
 
-    *buf = 0;
-}
+/*********************************************************************
+ *                                                                   *
+ *                              utility                              *
+ *                                                                   *
+ *********************************************************************/
 
-/***************
- * parse_entry *
- ***************/
+/***********
+ * span_is *
+ ***********/
 
-void
-parse_entry(char** data, char* buf)
-{
-    while (**data != '&' && **data != 0) {
-        *buf = **data;
-        (*data)++;
-        buf++;
-    }
+/* case insensitive compare of a length delimited span to a string */
 
-    *buf = 0;
+int
+span_is(char* span, int len, char* str)
+{
+    return (int)strlen(str) == len && strncasecmp(span, str, len) == 0;
 }
 
-/*****************
- * parse_key_val *
- *****************/
+/*************
+ * span_trim *
+ *************/
+
+/* drops blanks from both ends of a span */
 
 void
-parse_key_val(char* entry, char* key, char* val)
+span_trim(char** span, int* len)
 {
-    while (*entry != '=') {
-        *key = *entry;
-        entry++;
-        key++;
-    }
-
-    entry++;
-
-    while (*entry != 0 && *entry != ':' && *entry != ' ') {
-        *val = *entry;
-        entry++;
-        val++;
+    while (*len > 0 && (**span == ' ' || **span == '\t')) {
+        (*span)++;
+        (*len)--;
     }
 
-    *key = 0;
-    *val = 0;
+    while (*len > 0 && ((*span)[*len - 1] == ' ' || (*span)[*len - 1] == '\t'))
+        (*len)--;
 }
 
 /*****************
@@ -153,10 +234,16 @@ status_to_str(enum status_code status)
     switch (status) {
         case OK:
             return "OK";
+        case PARTIAL_CONTENT:
+            return "Partial Content";
+        case NOT_MODIFIED:
+            return "Not Modified";
         case BAD_REQUEST: 
             return "Bad Request";
         case NOT_FOUND:
             return "Not Found";
+        case RANGE_NOT_SATISFIABLE:
+            return "Range Not Satisfiable";
         default: 
     }
 
@@ -175,10 +262,32 @@ mime_to_str(enum mime_type type)
             return "text/html;charset=utf-8";
         case TEXT_CSS:
             return "text/css;charset=utf-8";
+        case TEXT_PLAIN:
+            return "text/plain;charset=utf-8";
+        case TEXT_JS:
+            return "text/javascript;charset=utf-8";
         case IMAGE_PNG: 
             return "image/png";
+        case IMAGE_JPEG:
+            return "image/jpeg";
+        case IMAGE_GIF:
+            return "image/gif";
+        case IMAGE_SVG:
+            return "image/svg+xml";
+        case IMAGE_ICON:
+            return "image/x-icon";
+        case IMAGE_WEBP:
+            return "image/webp";
         case APP_XFORM:
             return "application/x-www-form-urlencoded";
+        case APP_JSON:
+            return "application/json";
+        case APP_PDF:
+            return "application/pdf";
+        case APP_OCTET:
+            return "application/octet-stream";
+        case FONT_WOFF2:
+            return "font/woff2";
         default:
     }
 
@@ -190,71 +299,156 @@ mime_to_str(enum mime_type type)
  ************/
 
 enum mime_type
-str_to_mime(char* str)
+str_to_mime(char* str, int len)
 {
-    if (strcmp(str, "text/html;charset=utf-8") == 0)
+    if (span_is(str, len, "text/html;charset=utf-8"))
         return TEXT_HTML;
     
-    if (strcmp(str, "text/css;charset=utf-8") == 0)
+    if (span_is(str, len, "text/css;charset=utf-8"))
         return TEXT_CSS;
 
-    if (strcmp(str, "image/png") == 0)
+    if (span_is(str, len, "image/png"))
         return IMAGE_PNG;
 
-    if (strcmp(str, "application/x-www-form-urlencoded") == 0)
+    if (span_is(str, len, "application/x-www-form-urlencoded"))
         return APP_XFORM;
     
     return 0;
 }
 
-/*********
- * split *
- *********/
+/*****************
+ * mime_from_ext *
+ *****************/
 
-void
-split(char* start, int mid, char** left, char** right)
+/* guesses a file's type from its extension */
+
+enum mime_type
+mime_from_ext(char* path)
+{
+    char *ext, *slash;
+    int n_exts;
+
+    ext = strrchr(path, '.');
+    slash = strrchr(path, '/');
+
+    if (ext == NULL || (slash != NULL && ext < slash))
+        return APP_OCTET;
+
+    n_exts = sizeof(mime_exts) / sizeof(struct mime_ext);
+
+    for (int i = 0; i < n_exts; i++) {
+        if (strcasecmp(ext, mime_exts[i].ext) == 0)
+            return mime_exts[i].type;
+    }
+
+    return APP_OCTET;
+}
+
+/************
+ * uri_hash *
+ ************/
+
+/* 32 bit FNV-1a over a length delimited uri */
+
+uint32_t
+uri_hash(char* str, int len)
 {
-    *left = malloc(mid + 1);
-    memcpy(*left, start, mid);
-    (*left)[mid] = 0;
-    *right = strdup(start + mid);
+    uint32_t hash;
+
+    hash = 2166136261u;
+    for (int i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
 }
 
-/**********************
- * next_angle_bracket *
- **********************/
+/**************
+ * view_route *
+ **************/
+
+/* one hash of the uri and usually a single compare, NULL if unknown */
+
+struct route*
+view_route(char* resource, int len)
+{
+    struct route_slot* slot;
+    uint32_t hash, i;
+
+    if (routes == NULL)
+        return NULL;
+
+    hash = uri_hash(resource, len);
+
+    for (i = hash & routes_mask; ; i = (i + 1) & routes_mask) {
+        slot = &routes[i];
+
+        if (slot->route == NULL)
+            return NULL;
+
+        if (slot->hash == hash && slot->key_len == len &&
+            memcmp(slot->key, resource, len) == 0)
+            return slot->route;
+    }
+}
+
+/***************
+ * date_update *
+ ***************/
+
+/* renders the current second, called once a second by one thread */
 
 void
-next_angle_bracket(char** data)
+date_update()
 {
-    while (**data != '>')
-        (*data)++;
+    time_t now;
+    struct tm tm;
+    int next;
+
+    now = time(NULL);
+    gmtime_r(&now, &tm);
+
+    next = (atomic_load_explicit(&date_cur, memory_order_relaxed) + 1)
+           % DATE_SLOTS;
+
+    strftime(date_slots[next], MAX_DATE_LEN, date_fmt, &tm);
+    atomic_store_explicit(&date_cur, next, memory_order_release);
 }
 
-/*************
- * view_find *
- *************/
+/************
+ * date_now *
+ ************/
 
-int
-view_find(char* resource, char* page, struct file* file, enum mime_type* type)
+/* the cached Date value, DATE_LEN chars, lock free */
+
+char*
+date_now()
 {
-    int n_pages;
+    int cur;
 
-    n_pages = sizeof(view) / sizeof(struct route);
+    cur = atomic_load_explicit(&date_cur, memory_order_acquire);
+    if (date_slots[cur][0] == 0)
+        return date_blank;
 
-    for (int i = 0; i < n_pages; i++) {
-        if (strcmp(view[i].resource, resource) == 0) {
-            if (page)
-                strcpy(page, view[i].page);
-            if (file)
-                memcpy(file, &view[i].file, sizeof(struct file));
-            if (type)
-                *type = view[i].type;
-            return 0;
-        }
-    }
+    return date_slots[cur];
+}
 
-    return -1;
+/***************
+ * make_header *
+ ***************/
+
+/*
+ * renders everything but the connection header and final CRLF of a
+ * response head, the Date value always sits DATE_LEN + 2 from the end
+ */
+
+int
+make_header(char* hdr, int size, enum status_code status,
+            enum mime_type type, int content_len, char* date)
+{
+    return snprintf(hdr, size, head_fmt, status, status_to_str(status),
+                    mime_to_str(type), content_len, date);
 }
 
 /*********************************************************************
@@ -263,308 +457,2627 @@ view_find(char* resource, char* page, struct file* file, enum mime_type* type)
  *                                                                   *
  *********************************************************************/
 
-/*************
- * view_init *
- *************/
+/**************
+ * router_add *
+ **************/
 
-int
-view_init()
+void
+router_add(char* key, int key_len, struct route* route)
 {
-    FILE* fp;
-    int n_pages, status, size;
-    uint8_t* data;
-    struct file* file;
+    uint32_t hash, i;
 
-    n_pages = sizeof(view) / sizeof(struct route);
+    hash = uri_hash(key, key_len);
 
-    for (int i = 0; i < n_pages; i++) {
-        char* path;
+    i = hash & routes_mask;
+    while (routes[i].route != NULL)
+        i = (i + 1) & routes_mask;
 
-        file = &view[i].file;
+    routes[i].hash = hash;
+    routes[i].key = key;
+    routes[i].key_len = key_len;
+    routes[i].route = route;
+}
 
-        status = asprintf(&path, "%s%s", view_loc, view[i].page);
+/***************
+ * router_init *
+ ***************/
 
-        if (status < 0)
-            return -1;
+/* 
+ * compiles view into a linear probing table at most half full, so
+ * resolving a uri costs one pass over it instead of a scan of view,
+ * a discovered index.html also answers for its directory
+ */
 
-        fp = fopen(path, "r");
+int
+router_init()
+{
+    uint32_t size;
+    char* page;
+    int len, dir_len;
 
-        if (fp == NULL) {
-            fprintf(stderr, "[ERROR] fopen %s\n", strerror(errno));
-            free(path);
-            return -1;
-        }
+    /* every route may bring an alias */
 
-        /* get file size */
+    size = 2;
+    while (size < 4 * (uint32_t)n_routes)
+        size *= 2;
 
-        fseek(fp, 0, SEEK_END);
-        size = ftell(fp);
-        fseek(fp, 0, SEEK_SET);
+    free(routes);
+    routes = calloc(size, sizeof(struct route_slot));
+    if (routes == NULL)
+        return -1;
 
-        /* map file */
+    routes_mask = size - 1;
 
-        data = malloc(size + 1);
-        fread(data, size, 1, fp);
-        data[size] = 0;
+    for (int i = 0; i < n_routes; i++) {
+        router_add(view[i].resource, strlen(view[i].resource), &view[i]);
 
-        file->fp = fp;
-        file->data = data;
-        file->size = size;
-        
-        free(path);
+        if (view_cap == 0)
+            continue;
+
+        page = view[i].page;
+        len = strlen(page);
+        dir_len = len - (int)strlen("index.html");
+
+        if (dir_len > 0 && page[dir_len - 1] == '/' &&
+            strcmp(page + dir_len, "index.html") == 0)
+            router_add(page, dir_len, &view[i]);
     }
 
+    /* NULL falls back to the built in error page */
+
+    error_route = view_route("/4xx.html", 9);
+
     return 0;
 }
 
-/****************
- * request_init *
- ****************/
+/************
+ * view_add *
+ ************/
 
-void 
-request_init(struct request* req)
+/* appends a discovered file, page is "/" + its path under view_loc */
+
+int
+view_add(char* page)
 {
-    memset(req, 0, sizeof(struct request));
-}
+    struct route* routes_new;
+    struct route* route;
 
-/*****************
- * response_init *
- *****************/
+    if (n_routes == view_cap) {
+        view_cap = view_cap ? view_cap * 2 : 64;
+        routes_new = realloc(view, view_cap * sizeof(struct route));
+        if (routes_new == NULL)
+            return -1;
+        view = routes_new;
+    }
 
-void 
-response_init(struct response* resp) 
-{
-    memset(resp, 0, sizeof(struct response));
+    route = &view[n_routes++];
+    memset(route, 0, sizeof(struct route));
+    route->resource = page;
+    route->page = page;
+    route->type = mime_from_ext(page);
+
+    return 0;
 }
 
-/*********************************************************************
- *                                                                   *
- *                             conversion                            *
- *                                                                   *
- *********************************************************************/
+/*************
+ * view_walk *
+ *************/
 
-/*****************
- * parse_request *
- *****************/
+/* adds every regular file below dir, which is relative to view_loc */
 
-enum status_code
-parse_request(struct request* req, char* data)
+int
+view_walk(char* dir)
 {
-    char buf[MAX_BUF_LEN];
-    int status;
+    DIR* dp;
+    struct dirent* ent;
+    struct stat st;
+    char *path, *page;
+    int status, found;
 
-    status = 0;
+    if (asprintf(&path, "%s%s", view_loc, dir) < 0)
+        return -1;
 
-    /* request method type */
+    dp = opendir(path);
+    free(path);
 
-    req->method = -1;
-    parse_word(&data, buf);
-    skip(&data);
-    
-    if (strcmp(buf, "GET") == 0) {
-        req->method = GET;
+    if (dp == NULL) {
+        fprintf(stderr, "[ERROR] opendir %s\n", strerror(errno));
+        return -1;
     }
 
-    if (strcmp(buf, "POST") == 0) {
-        req->method = POST;
-    }
+    status = 0;
 
-    if ((int)req->method == -1)
-        return BAD_REQUEST;
+    while (status == 0 && (ent = readdir(dp)) != NULL) {
 
-    /* uri */
+        /* skip dot files, ., .. and editor droppings alike */
 
-    parse_word(&data, buf);
-    skip(&data);
+        if (ent->d_name[0] == '.')
+            continue;
 
-    status = view_find(buf, NULL, NULL, NULL);
-    if (status < 0)
-        return NOT_FOUND;
+        if (asprintf(&page, "%s/%s", dir, ent->d_name) < 0) {
+            status = -1;
+            break;
+        }
 
-    strcpy(req->uri, buf);
- 
-    /* version */
-    
-    parse_word(&data, buf);
-    skip(&data);
-    
-    /* headers */
-
-    end_of_line(&data);
-    data += 2;    /* skip \r\n */
-    while (!is_crlf(data)) {
-        skip(&data);
-        parse_word(&data, buf);
-        skip(&data);
-        
-        if (strcmp("Content-Type:", buf) == 0) {
-            parse_word(&data, buf);
-            skip(&data);
-            req->content_type = str_to_mime(buf); 
-            if (req->content_type == 0)
-                return BAD_REQUEST;
+        if (asprintf(&path, "%s%s", view_loc, page) < 0) {
+            free(page);
+            status = -1;
+            break;
         }
 
-        if (strcmp("Content-Length:", buf) == 0) {
-            parse_word(&data, buf);
-            skip(&data);
-            req->content_len = atoi(buf);
-            if (req->content_len == 0)
-                return BAD_REQUEST;
+        /* 
+         * links to files are followed, into directories never, a loop
+         * of them would recurse until the stack runs out
+         */
+
+        found = lstat(path, &st) == 0;
+        if (found && S_ISLNK(st.st_mode))
+            found = stat(path, &st) == 0 && !S_ISDIR(st.st_mode);
+
+        if (!found || strlen(page) >= MAX_URI_LEN) {
+            free(page);
+        } else if (S_ISDIR(st.st_mode)) {
+            status = view_walk(page);
+            free(page);
+        } else if (S_ISREG(st.st_mode)) {
+            status = view_add(page);
+        } else {
+            free(page);
         }
 
-        end_of_line(&data);
-        data += 2;
+        free(path);
     }
-    data += 2;
-    skip(&data);
-
-    /* body */
 
-    if (req->content_len != 0) {
-        req->content = malloc(req->content_len + 1);
-        memcpy(req->content, data, req->content_len);
-        req->content[req->content_len] = 0;
-    }
+    closedir(dp);
 
-    return 0;
+    return status;
 }
 
 /*****************
- * make_response *
+ * view_discover *
  *****************/
 
-void 
-make_response(struct response* resp, char** data, int* data_len)
+/* 
+ * replaces the hardcoded pages with every file under view_loc, call
+ * before view_init
+ */
+
+int
+view_discover()
 {
-    time_t now;
-    struct tm* tm;
-    int len, full_len;
-    char *buf, *full_buf, *status_msg, *content_type;
-    char date[MAX_DATE_LEN];
+    view = NULL;
+    n_routes = 0;
+    view_cap = 0;
 
-    status_msg = status_to_str(resp->status);
-    content_type = mime_to_str(resp->content_type);
+    if (view_walk("") < 0)
+        return -1;
 
-    now = time(NULL);
-    tm = gmtime(&now);
+    if (n_routes == 0) {
+        fprintf(stderr, "[ERROR] no files under %s\n", view_loc);
+        return -1;
+    }
+
+    return 0;
+}
 
-    strftime(date, MAX_DATE_LEN, date_fmt, tm);
-    len = asprintf(&buf, resp_fmt, resp->status, status_msg, 
-                   content_type, resp->content_len, date);
+/**************
+ * file_alloc *
+ **************/
 
-    /* pray to god len > 0 */
+/* 
+ * a version holding data, mapped if map_len is set and malloced if
+ * not, it has no validator until file_tag
+ */
 
-    full_len = len + resp->content_len;
+struct file*
+file_alloc(uint8_t* data, int size, size_t map_len)
+{
+    struct file* file;
 
-    full_buf = malloc(full_len);
-    memcpy(full_buf, buf, len);
-    memcpy(full_buf + len, resp->content, resp->content_len);
+    file = calloc(1, sizeof(struct file));
+    if (file == NULL) {
+        if (map_len)
+            munmap(data, map_len);
+        else
+            free(data);
+        return NULL;
+    }
 
-    free(buf);
+    file->fd = -1;
+    file->data = data;
+    file->size = size;
+    file->map_len = map_len;
+    atomic_init(&file->refs, 1);
 
-    *data = full_buf;
-    *data_len = full_len;
+    return file;
 }
 
-/*********************************************************************
- *                                                                   *
- *                              routing                              *
- *                                                                   *
- *********************************************************************/
+/************
+ * file_tag *
+ ************/
 
-/******************
- * route_response *
- ******************/
+/*
+ * sets the strong validator, a hash of the bytes, or for a mapped page
+ * of its inode, size and mtime so that naming it never faults the
+ * mapping in
+ */
 
 void
-route_response(struct response* resp, struct request* req)
+file_tag(struct file* file, struct stat* st)
 {
-    struct file file;
+    uint64_t hash, id[4];
+    uint8_t* bytes;
+    int len;
 
-    resp->status = OK;
-    view_find(req->uri, NULL, &file, &resp->content_type);
-    resp->content = file.data;
-    resp->content_len = file.size;
-}
+    bytes = file->data;
+    len = file->size;
 
-/***************
- * handle_post *
- ***************/
+    if (file->map_len && st != NULL) {
+        id[0] = st->st_dev;
+        id[1] = st->st_ino;
+        id[2] = st->st_size;
+        id[3] = st->st_mtim.tv_sec * 1000000000ull + st->st_mtim.tv_nsec;
+        bytes = (uint8_t*)id;
+        len = sizeof(id);
+    }
 
-void
-handle_post(struct request* req, char* html, char** res)
-{
-    struct post_entry entries[MAX_POST_ENTRIES];
-    char entry[MAX_BUF_LEN], key[MAX_BUF_LEN], val[MAX_BUF_LEN];
-    char buf[MAX_BUF_LEN];
-    char *content, *start, *cur;
-    int len;
+    hash = 14695981039346656037ull;
+    for (int i = 0; i < len; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
 
-    /* parse entries into a table */
+    snprintf(file->etag, sizeof(file->etag), "\"%016llx\"",
+             (unsigned long long)hash);
+}
 
-    len = 0;
-    content = (char*)req->content;
-    while (*content != 0 && len < MAX_POST_ENTRIES) {
-        parse_entry(&content, entry);
-        if (*content)
-            content++;
-        parse_key_val(entry, key, val);
-        strcpy(entries[len].key, key);
-        strcpy(entries[len].val, val);
-        len++;
-    }
+/*************
+ * file_head *
+ *************/
 
-    /* ignore status */
+/* 
+ * (re)builds the 200 and 304 heads, they never change but for their
+ * Date, anything with variants tells caches it varies by encoding
+ */
 
-    start = strdup(html);
+int
+file_head(struct file* file, enum mime_type type)
+{
+    const char* vary;
 
-    for (int i = 0; i < len; i++) {
-        int mid;
-        char *key, *val, *target, *left, *right;
-        
-        mid = 0;
-        key = entries[i].key;
-        val = entries[i].val;
-        asprintf(&target, "id=\"%s\"", key);
-
-        cur = start;
-
-        while (*cur != 0) {
-            parse_word(&cur, buf);
-            skip(&cur);
-            if (strcmp(target, buf) == 0) {
-                next_angle_bracket(&cur);
-                mid = cur - start + 1;
-                split(start, mid, &left, &right);
-                free(start);
-                asprintf(&start, "%s%s%s", left, val, right);
-                cur = start + mid + 1;
-                free(left);
-                free(right);
-            }
-        }
+    if (file->header == NULL)
+        file->header = malloc(2 * MAX_HEADER_LEN);
+    if (file->header == NULL)
+        return -1;
 
-        free(target);
+    vary = "";
+    for (int i = 0; i < N_ENCODINGS; i++) {
+        if (file->variants[i] != NULL || file->encoding != ENC_IDENTITY)
+            vary = vary_line;
     }
 
-    *res = start;
+    file->header_len = snprintf(file->header, MAX_HEADER_LEN, file_fmt,
+                                mime_to_str(type), file->size,
+                                enc_lines[file->encoding], vary, file->etag,
+                                file->last_modified, date_blank);
+    file->date_off = file->header_len - 2 - DATE_LEN;
+
+    file->nm_header = file->header + MAX_HEADER_LEN;
+    file->nm_header_len = snprintf(file->nm_header, MAX_HEADER_LEN, nm_fmt,
+                                   vary, file->etag, file->last_modified,
+                                   date_blank);
+    file->nm_date_off = file->nm_header_len - 2 - DATE_LEN;
+
+    return 0;
 }
 
-/***************
- * route_error *
- ***************/
+/*************
+ * file_make *
+ *************/
 
-void
-route_error(struct response* resp, enum status_code status)
+/* 
+ * wraps size bytes of data (NUL terminated past size) in a version
+ * with one ref and a prebuilt head, the version owns data after this,
+ * a mapping of map_len bytes or a malloc when map_len is 0, st is the
+ * page's on disk or NULL for one made in memory
+ */
+
+struct file*
+file_make(struct route* route, uint8_t* data, int size, size_t map_len,
+          struct stat* st)
 {
-    struct file file;
+    struct file* file;
+    struct tm tm;
 
-    resp->status = status;
-    view_find("/4xx.html", NULL, &file, NULL);
-    resp->content_len = asprintf((char**)&resp->content, (char*)file.data, status, status_to_str(status));
-    resp->content_type = TEXT_HTML; 
+    file = file_alloc(data, size, map_len);
+    if (file == NULL)
+        return NULL;
 
+    file_tag(file, st);
+
+    file->mtime = st ? st->st_mtime : 0;
+    gmtime_r(&file->mtime, &tm);
+    strftime(file->last_modified, sizeof(file->last_modified), date_fmt, &tm);
+
+    if (file_head(file, route->type) < 0) {
+        file_put(file);
+        return NULL;
+    }
+
+    /* pages that take posts get their slots found once, here */
+
+    if (route->type == TEXT_HTML && template_compile(file) < 0) {
+        file_put(file);
+        return NULL;
+    }
+
+    return file;
+}
+
+/********************
+ * template_compile *
+ ********************/
+
+/*
+ * finds every id="name" attribute in an html page, the value posted for
+ * name is rendered right after the '>' closing that tag
+ */
+
+int
+template_compile(struct file* file)
+{
+    struct slot* slots;
+    char *data, *end, *cur, *key, *quote, *close;
+    int n, cap;
+
+    data = (char*)file->data;
+    end = data + file->size;
+    cur = data;
+
+    slots = NULL;
+    n = cap = 0;
+
+    while ((cur = memchr(cur, 'i', end - cur)) != NULL) {
+        key = cur + 4;
+
+        if (end - cur < 4 || memcmp(cur, "id=\"", 4) != 0) {
+            cur++;
+            continue;
+        }
+
+        /* a whole attribute, not the tail of data-id="..." */
+
+        if (cur > data && !isspace((unsigned char)cur[-1])) {
+            cur = key;
+            continue;
+        }
+
+        quote = memchr(key, '"', end - key);
+        if (quote == NULL)
+            break;
+
+        close = memchr(quote, '>', end - quote);
+        if (close == NULL)
+            break;
+
+        if (n == cap) {
+            cap = cap ? cap * 2 : 8;
+            slots = realloc(file->slots, cap * sizeof(struct slot));
+            if (slots == NULL)
+                return -1;
+            file->slots = slots;
+        }
+
+        file->slots[n].off = close + 1 - data;
+        file->slots[n].key = key - data;
+        file->slots[n].key_len = quote - key;
+        n++;
+
+        cur = close + 1;
+    }
+
+    file->n_slots = n;
+
+    return 0;
+}
+
+/*******************
+ * mime_compresses *
+ *******************/
+
+/* text formats, the rest are compressed already */
+
+int
+mime_compresses(enum mime_type type)
+{
+    switch (type) {
+        case TEXT_HTML:
+        case TEXT_CSS:
+        case TEXT_PLAIN:
+        case TEXT_JS:
+        case IMAGE_SVG:
+        case APP_JSON:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/***************
+ * gzip_encode *
+ ***************/
+
+uint8_t*
+gzip_encode(uint8_t* data, int size, int* out_size)
+{
+    z_stream zs;
+    uint8_t* out;
+    uLong cap;
+
+    memset(&zs, 0, sizeof(zs));
+
+    /* 16 on top of the window bits asks for a gzip wrapper */
+
+    if (deflateInit2(&zs, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 9,
+                     Z_DEFAULT_STRATEGY) != Z_OK)
+        return NULL;
+
+    cap = deflateBound(&zs, size);
+    out = malloc(cap);
+    if (out == NULL) {
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    zs.next_in = data;
+    zs.avail_in = size;
+    zs.next_out = out;
+    zs.avail_out = cap;
+
+    if (deflate(&zs, Z_FINISH) != Z_STREAM_END) {
+        free(out);
+        deflateEnd(&zs);
+        return NULL;
+    }
+
+    *out_size = zs.total_out;
+    deflateEnd(&zs);
+
+    return out;
+}
+
+/*************
+ * br_encode *
+ *************/
+
+uint8_t*
+br_encode(uint8_t* data, int size, int* out_size)
+{
+    uint8_t* out;
+    size_t cap;
+
+    cap = BrotliEncoderMaxCompressedSize(size);
+    if (cap == 0)
+        return NULL;
+
+    out = malloc(cap);
+    if (out == NULL)
+        return NULL;
+
+    if (!BrotliEncoderCompress(BROTLI_MAX_QUALITY, BROTLI_DEFAULT_WINDOW,
+                               BROTLI_MODE_TEXT, size, data, &cap, out)) {
+        free(out);
+        return NULL;
+    }
+
+    *out_size = cap;
+
+    return out;
+}
+
+/****************
+ * sibling_read *
+ ****************/
+
+/*
+ * a precompressed page.gz or page.br next to path, NULL if there is
+ * none or it is older than mtime and so maybe of an older page
+ */
+
+uint8_t*
+sibling_read(char* path, enum encoding enc, time_t mtime, int* size)
+{
+    struct stat st;
+    uint8_t* data;
+    char* sibling;
+    int fd, n, got;
+
+    if (asprintf(&sibling, "%s%s", path, enc_exts[enc]) < 0)
+        return NULL;
+
+    fd = open(sibling, O_RDONLY | O_CLOEXEC);
+    free(sibling);
+    if (fd < 0)
+        return NULL;
+
+    data = NULL;
+    if (fstat(fd, &st) < 0 || st.st_mtime < mtime || st.st_size == 0)
+        goto done;
+
+    data = malloc(st.st_size);
+    if (data == NULL)
+        goto done;
+
+    for (got = 0; got < st.st_size; got += n) {
+        n = read(fd, data + got, st.st_size - got);
+        if (n <= 0) {
+            free(data);
+            data = NULL;
+            goto done;
+        }
+    }
+
+    *size = got;
+
+done:
+    close(fd);
+    return data;
+}
+
+/***************
+ * file_encode *
+ ***************/
+
+/*
+ * hangs gzip and br variants off a text file, taken from siblings on
+ * disk when they are there and compressed here otherwise, a variant
+ * that does not come out smaller is dropped
+ */
+
+int
+file_encode(struct file* file, struct route* route, char* path)
+{
+    struct file* variant;
+    uint8_t* data;
+    int size;
+
+    if (!mime_compresses(route->type) || file->size < COMPRESS_MIN)
+        return 0;
+
+    for (int enc = ENC_GZIP; enc < N_ENCODINGS; enc++) {
+        data = sibling_read(path, enc, file->mtime, &size);
+        if (data == NULL && enc == ENC_GZIP)
+            data = gzip_encode(file->data, file->size, &size);
+        if (data == NULL && enc == ENC_BR)
+            data = br_encode(file->data, file->size, &size);
+
+        if (data == NULL)
+            continue;
+
+        if (size >= file->size) {
+            free(data);
+            continue;
+        }
+
+        variant = file_alloc(data, size, 0);
+        if (variant == NULL)
+            continue;
+
+        file_tag(variant, NULL);
+        variant->encoding = enc;
+        variant->mtime = file->mtime;
+        memcpy(variant->last_modified, file->last_modified, DATE_LEN + 1);
+
+        if (file_head(variant, route->type) < 0) {
+            file_put(variant);
+            continue;
+        }
+
+        file->variants[enc] = variant;
+    }
+
+    /* the identity head now has to say it varies too */
+
+    return file_head(file, route->type);
+}
+
+/************
+ * file_map *
+ ************/
+
+/*
+ * maps size bytes of fd read only, with the page cache's own pages so
+ * every reactor shares one copy, the tail of the mapping is zero so the
+ * data stays NUL terminated past size like a read copy
+ */
+
+uint8_t*
+file_map(int fd, int size, size_t* map_len)
+{
+    uint8_t *base, *data;
+    size_t page, len, align, span;
+
+    page = sysconf(_SC_PAGESIZE);
+    len = (size + page) & ~(page - 1);
+
+    /* a huge page needs an address aligned to one */
+
+    align = page;
+    if (view_huge && size >= HUGE_PAGE)
+        align = HUGE_PAGE;
+
+    span = len + align - page;
+    base = mmap(NULL, span, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED)
+        return NULL;
+
+    data = (uint8_t*)(((uintptr_t)base + align - 1) & ~(align - 1));
+    if (data > base)
+        munmap(base, data - base);
+    if (base + span > data + len)
+        munmap(data + len, base + span - (data + len));
+
+    /* 
+     * over the zeroed reservation, not faulted in since mapped pages
+     * leave by sendfile and a reactor should not wait on the disk
+     */
+
+    if (mmap(data, size, PROT_READ, MAP_SHARED | MAP_FIXED, fd, 0) ==
+        MAP_FAILED) {
+        munmap(data, len);
+        return NULL;
+    }
+
+    if (align > page)
+        madvise(data, len, MADV_HUGEPAGE);
+
+    *map_len = len;
+    return data;
+}
+
+/*************
+ * file_load *
+ *************/
+
+/*
+ * opens a route's page into a fresh version with one ref, large pages
+ * are mapped and only ever leave through sendfile, small ones are read
+ * into the heap since they get copied into responses anyway, bundled
+ * pages come straight from the bundle, variants are only made when
+ * asked to encode since compressing is far too slow for a reactor
+ */
+
+struct file*
+file_load(struct route* route, int encode)
+{
+    struct file* file;
+    struct stat st;
+    uint8_t* data;
+    size_t map_len;
+    char* path;
+    int fd, got, n;
+
+    if (route->entry != NULL)
+        return bundle_load(route);
+
+    if (asprintf(&path, "%s%s", view_loc, route->page) < 0)
+        return NULL;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR] open %s: %s\n", path, strerror(errno));
+        free(path);
+        return NULL;
+    }
+
+    if (fstat(fd, &st) < 0) {
+        fprintf(stderr, "[ERROR] fstat %s: %s\n", path, strerror(errno));
+        goto fail;
+    }
+
+    if (st.st_size > INT_MAX) {
+        fprintf(stderr, "[ERROR] %s is too large\n", path);
+        goto fail;
+    }
+
+    map_len = 0;
+    if (st.st_size >= MAP_MIN) {
+        data = file_map(fd, st.st_size, &map_len);
+        if (data == NULL) {
+            fprintf(stderr, "[ERROR] mmap %s: %s\n", path, strerror(errno));
+            goto fail;
+        }
+    } else {
+        data = malloc(st.st_size + 1);
+        if (data == NULL)
+            goto fail;
+
+        for (got = 0; got < st.st_size; got += n) {
+            n = read(fd, data + got, st.st_size - got);
+            if (n <= 0) {
+                free(data);
+                goto fail;
+            }
+        }
+
+        data[got] = 0;
+
+        /* read pages never go out by sendfile, so they hold no fd */
+
+        close(fd);
+        fd = -1;
+    }
+
+    file = file_make(route, data, st.st_size, map_len, &st);
+    if (file == NULL)
+        goto fail;
+
+    file->fd = fd;
+
+    if (encode && file_encode(file, route, path) < 0) {
+        free(path);
+        file_put(file);
+        return NULL;
+    }
+
+    free(path);
+
+    return file;
+
+fail:
+    if (fd >= 0)
+        close(fd);
+    free(path);
+    return NULL;
+}
+
+/*************
+ * view_init *
+ *************/
+
+/*
+ * pages load on their first request, but each one has to be there now
+ * so a missing page fails the start rather than a request
+ */
+
+int
+view_init()
+{
+    uint8_t bits[BOUNDARY_LEN / 2];
+    uint64_t seed;
+    char* path;
+
+    for (int i = 0; i < n_routes; i++) {
+        if (view[i].entry != NULL)
+            continue;
+
+        if (asprintf(&path, "%s%s", view_loc, view[i].page) < 0)
+            return -1;
+
+        if (access(path, R_OK) < 0) {
+            fprintf(stderr, "[ERROR] %s: %s\n", path, strerror(errno));
+            free(path);
+            return -1;
+        }
+
+        free(path);
+    }
+
+    if (getrandom(bits, sizeof(bits), 0) != sizeof(bits)) {
+        seed = (uint64_t)time(NULL) * 1099511628211ull ^ getpid();
+        for (size_t i = 0; i < sizeof(bits); i++)
+            bits[i] = seed >> (8 * (i % 8)) ^ i;
+    }
+
+    for (size_t i = 0; i < sizeof(bits); i++)
+        snprintf(boundary + 2 * i, 3, "%02x", bits[i]);
+
+    return router_init();
+}
+
+/****************
+ * request_init *
+ ****************/
+
+void 
+request_init(struct request* req, struct arena* arena)
+{
+    memset(req, 0, sizeof(struct request));
+    req->arena = arena;
+    req->form.arena = arena;
+    req->state = PARSE_LINE;
+    req->status = OK;
+}
+
+/*****************
+ * response_init *
+ *****************/
+
+void 
+response_init(struct response* resp, struct arena* arena) 
+{
+    memset(resp, 0, sizeof(struct response));
+    resp->arena = arena;
+    resp->fd = -1;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                             conversion                            *
+ *                                                                   *
+ *********************************************************************/
+
+/**********************
+ * parse_request_line *
+ **********************/
+
+/* method, uri and version from a line without its CRLF */
+
+int
+parse_request_line(struct request* req, char* line, int len)
+{
+    char *uri, *version, *end;
+    int uri_len;
+
+    end = line + len;
+
+    /* request method type */
+
+    uri = memchr(line, ' ', len);
+    if (uri == NULL)
+        return -1;
+
+    if (uri - line == 3 && memcmp(line, "GET", 3) == 0)
+        req->method = GET;
+    else if (uri - line == 4 && memcmp(line, "POST", 4) == 0)
+        req->method = POST;
+    else
+        return -1;
+
+    /* uri */
+
+    uri++;
+    version = memchr(uri, ' ', end - uri);
+    if (version == NULL)
+        return -1;
+
+    uri_len = version - uri;
+    if (uri_len == 0 || uri_len >= MAX_URI_LEN)
+        return -1;
+
+    memcpy(req->uri, uri, uri_len);
+    req->uri[uri_len] = 0;
+    req->route = view_route(uri, uri_len);
+
+    /* version */
+
+    version++;
+    if (end - version != 8 || memcmp(version, "HTTP/1.", 7) != 0)
+        return -1;
+
+    if (version[7] != '0' && version[7] != '1')
+        return -1;
+
+    /* HTTP/1.1 connections persist unless told otherwise */
+
+    req->minor = version[7] - '0';
+    req->keep_alive = req->minor == 1;
+
+    /* an unknown page is not a parse error, keep the stream in sync */
+
+    if (req->route == NULL)
+        req->status = NOT_FOUND;
+
+    return 0;
+}
+
+/*****************
+ * header_lookup *
+ *****************/
+
+/* N_HEADERS for a name that has no slot */
+
+enum header_id
+header_lookup(char* name, int len)
+{
+    for (int i = 0; i < n_header_names; i++) {
+        if (header_names[i].len > len)
+            break;
+        if (header_names[i].len == len &&
+            strncasecmp(header_names[i].name, name, len) == 0)
+            return header_names[i].id;
+    }
+
+    return N_HEADERS;
+}
+
+/**************
+ * header_get *
+ **************/
+
+/* 
+ * value of a known header in O(1), NULL if the request did not send
+ * it, only good while the request's bytes are still in the buffer
+ */
+
+char*
+header_get(struct request* req, enum header_id id, int* len)
+{
+    if (req->known[id].off == 0)
+        return NULL;
+
+    *len = req->known[id].len;
+    return req->data + req->known[id].off;
+}
+
+/****************
+ * parse_header *
+ ****************/
+
+/*
+ * a single "name: value" line without its CRLF, colon already found,
+ * every header is kept as spans and a known one also fills its slot
+ */
+
+int
+parse_header(struct request* req, char* line, int len, char* colon)
+{
+    struct header *headers, *header;
+    char* val;
+    int name_len, val_len, cap;
+    enum header_id id;
+    long content_len;
+
+    if (colon == NULL || colon >= line + len)
+        return -1;
+
+    name_len = colon - line;
+    val = colon + 1;
+    val_len = line + len - val;
+    span_trim(&val, &val_len);
+
+    if (req->n_headers == req->headers_cap) {
+        cap = req->headers_cap ? req->headers_cap * 2 : 16;
+        headers = arena_grow(req->arena, req->headers,
+                             req->headers_cap * sizeof(struct header),
+                             cap * sizeof(struct header));
+        if (headers == NULL)
+            return -1;
+        req->headers = headers;
+        req->headers_cap = cap;
+    }
+
+    header = &req->headers[req->n_headers++];
+    header->name.off = line - req->data;
+    header->name.len = name_len;
+    header->val.off = val - req->data;
+    header->val.len = val_len;
+
+    id = header_lookup(line, name_len);
+    if (id == N_HEADERS)
+        return 0;
+
+    /* a repeat keeps the first slot but still has its say below */
+
+    if (req->known[id].off == 0)
+        req->known[id] = header->val;
+
+    if (id == HDR_CONTENT_TYPE) {
+        req->content_type = str_to_mime(val, val_len);
+        if (req->content_type == 0)
+            return -1;
+    }
+
+    /* 
+     * chunked bodies are never decoded, so where this one ends is not
+     * known, taking the chunks for the next request would smuggle one
+     */
+
+    if (id == HDR_TRANSFER_ENCODING)
+        return -1;
+
+    if (id == HDR_CONTENT_LENGTH) {
+        if (val_len == 0)
+            return -1;
+
+        content_len = 0;
+        for (int i = 0; i < val_len; i++) {
+            if (val[i] < '0' || val[i] > '9')
+                return -1;
+            content_len = content_len * 10 + (val[i] - '0');
+            if (content_len > MAX_CONTENT_LEN)
+                return -1;
+        }
+
+        /* conflicting lengths would desync the stream */
+
+        if (req->known[id].off != header->val.off &&
+            content_len != req->content_len)
+            return -1;
+
+        req->content_len = content_len;
+    }
+
+    if (id == HDR_CONNECTION) {
+        char *tok, *comma;
+        int tok_len;
+
+        /* comma separated options, only close and keep-alive matter */
+
+        while (val_len > 0) {
+            comma = memchr(val, ',', val_len);
+            tok = val;
+            tok_len = comma ? comma - val : val_len;
+
+            val += tok_len;
+            val_len -= tok_len;
+            if (comma) {
+                val++;
+                val_len--;
+            }
+
+            span_trim(&tok, &tok_len);
+
+            if (span_is(tok, tok_len, "close"))
+                req->keep_alive = 0;
+            if (span_is(tok, tok_len, "keep-alive"))
+                req->keep_alive = 1;
+        }
+    }
+
+    return 0;
+}
+
+/*****************
+ * parse_request *
+ *****************/
+
+/*
+ * feeds the parser the first len bytes of a request, data must start
+ * at the same request on every call but may have moved or grown, it
+ * picks up from the line it stopped at instead of starting over
+ */
+
+enum parse_result
+parse_request(struct request* req, char* data, int len)
+{
+    struct form* form;
+    char *eol, *line, *colon;
+    int line_len, next, status, got;
+
+    req->data = data;
+
+    while (req->state != PARSE_END) {
+
+        /* body */
+
+        if (req->state == PARSE_BODY) {
+            form = &req->form;
+            got = len - req->body;
+            if (got > req->content_len)
+                got = req->content_len;
+
+            /* 
+             * the body stays where it arrived and forms decode over
+             * their own raw bytes, data may have moved since the last
+             * feed so both are pointed at it again
+             */
+
+            req->content = (uint8_t*)data + req->body;
+            form->data = data + req->body;
+
+            if (req->content_type == APP_XFORM && got > form->len &&
+                form_feed(form, got - form->len) < 0) {
+                req->status = BAD_REQUEST;
+                return PARSE_ERROR;
+            }
+
+            if (got < req->content_len)
+                return PARSE_AGAIN;
+
+            if (req->content_type == APP_XFORM && form_end(form) < 0) {
+                req->status = BAD_REQUEST;
+                return PARSE_ERROR;
+            }
+
+            req->len = req->body + req->content_len;
+            req->state = PARSE_END;
+            break;
+        }
+
+        /* 
+         * request line and headers go one line at a time, the line end
+         * and a header's colon turn up in the same vector scan
+         */
+
+        colon = req->colon ? data + req->colon : NULL;
+        eol = scan_line(data + req->scan, data + len, &colon);
+        if (colon != NULL)
+            req->colon = colon - data;
+
+        if (eol == NULL) {
+            req->scan = len;
+            return PARSE_AGAIN;
+        }
+
+        line = data + req->line;
+        line_len = eol - line;
+        if (line_len > 0 && line[line_len - 1] == '\r')
+            line_len--;
+
+        next = eol - data + 1;
+        status = 0;
+
+        if (req->state == PARSE_LINE) {
+            /* tolerate stray blank lines between requests */
+            if (line_len > 0) {
+                status = parse_request_line(req, line, line_len);
+                req->state = PARSE_HEADERS;
+            }
+        } else if (line_len > 0) {
+            status = parse_header(req, line, line_len, colon);
+        } else {
+            /* empty line ends the headers */
+            req->body = next;
+            req->len = next;
+            req->state = req->content_len ? PARSE_BODY : PARSE_END;
+        }
+
+        if (status < 0) {
+            req->status = BAD_REQUEST;
+            return PARSE_ERROR;
+        }
+
+        req->line = next;
+        req->scan = next;
+        req->colon = 0;
+    }
+
+    return PARSE_DONE;
+}
+
+/***************
+ * buf_reserve *
+ ***************/
+
+/* makes room for len more bytes past buf->len */
+
+int
+buf_reserve(struct buf* buf, int len)
+{
+    char* data;
+    int cap;
+
+    if (buf->len + len <= buf->cap)
+        return 0;
+
+    if (buf->pool != NULL && buf->len + len <= POOL_MAX) {
+        data = pool_get(buf->pool, buf->len + len, &cap);
+        if (data == NULL)
+            return -1;
+        if (buf->data != NULL) {
+            memcpy(data, buf->data, buf->len);
+            pool_put(buf->pool, buf->data, buf->cap);
+        }
+
+        buf->data = data;
+        buf->cap = cap;
+        return 0;
+    }
+
+    cap = buf->cap ? buf->cap : MAX_HEADER_LEN;
+    while (cap < buf->len + len)
+        cap *= 2;
+
+    /* leaving the pool, the chunk can not be realloc'd */
+
+    if (buf->pool != NULL && buf->cap <= POOL_MAX) {
+        data = malloc(cap);
+        if (data != NULL && buf->data != NULL) {
+            memcpy(data, buf->data, buf->len);
+            pool_put(buf->pool, buf->data, buf->cap);
+        }
+    } else {
+        data = realloc(buf->data, cap);
+    }
+
+    if (data == NULL)
+        return -1;
+
+    buf->data = data;
+    buf->cap = cap;
+
+    return 0;
+}
+
+/*****************
+ * make_response *
+ *****************/
+
+/*
+ * appends the serialized response to out, pipelined responses land
+ * back to back in the same buffer and go out in one write, a body
+ * backed by resp->fd is left for the caller to sendfile, -1 and out
+ * untouched if there is no room for it
+ */
+
+int 
+make_response(struct response* resp, struct buf* out)
+{
+    int len, conn_len, body_len;
+    char *connection, *hdr, *date;
+
+    /* 1.1 persists by default, 1.0 has to be told it may */
+
+    connection = "\r\n";
+    if (!resp->keep_alive)
+        connection = "Connection: close\r\n\r\n";
+    else if (resp->minor == 0)
+        connection = "Connection: keep-alive\r\n\r\n";
+
+    conn_len = strlen(connection);
+    date = date_now();
+
+    /* a body sent from a file or in parts is queued by the caller */
+
+    body_len = resp->content_len;
+    if (resp->fd >= 0 || resp->n_parts > 0)
+        body_len = 0;
+
+    if (buf_reserve(out, MAX_HEADER_LEN + body_len) < 0)
+        return -1;
+
+    hdr = out->data + out->len;
+
+    if (resp->head != NULL) {
+        len = resp->head_len;
+        memcpy(hdr, resp->head, len);
+    } else if (resp->file != NULL && resp->status == NOT_MODIFIED) {
+        len = resp->file->nm_header_len;
+        memcpy(hdr, resp->file->nm_header, len);
+        memcpy(hdr + resp->file->nm_date_off, date, DATE_LEN);
+    } else if (resp->file != NULL) {
+        /* hot path, copy the prebuilt head and patch in the date */
+        len = resp->file->header_len;
+        memcpy(hdr, resp->file->header, len);
+        memcpy(hdr + resp->file->date_off, date, DATE_LEN);
+    } else {
+        len = make_header(hdr, MAX_HEADER_LEN - conn_len, resp->status,
+                          resp->content_type, resp->content_len, date);
+    }
+
+    memcpy(hdr + len, connection, conn_len);
+    out->len += len + conn_len;
+
+    if (body_len > 0) {
+        memcpy(out->data + out->len, resp->content, body_len);
+        out->len += body_len;
+    }
+
+    return 0;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                              routing                              *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * parse_date *
+ **************/
+
+/* an IMF-fixdate, the only form we send, -1 for anything else */
+
+time_t
+parse_date(char* str, int len)
+{
+    struct tm tm;
+    char* shape;
+    int mon;
+
+    if (len != DATE_LEN)
+        return -1;
+
+    /* digits where shape has 0s, its punctuation verbatim */
+
+    shape = "xxx, 00 xxx 0000 00:00:00 GMT";
+    for (int i = 0; i < DATE_LEN; i++) {
+        if (shape[i] == '0' ? !isdigit((unsigned char)str[i]) :
+            shape[i] != 'x' && shape[i] != str[i])
+            return -1;
+    }
+
+    for (mon = 0; mon < 12; mon++) {
+        if (memcmp(months + 3 * mon, str + 8, 3) == 0)
+            break;
+    }
+
+    if (mon == 12)
+        return -1;
+
+    memset(&tm, 0, sizeof(tm));
+    tm.tm_mday = atoi(str + 5);
+    tm.tm_mon = mon;
+    tm.tm_year = atoi(str + 12) - 1900;
+    tm.tm_hour = atoi(str + 17);
+    tm.tm_min = atoi(str + 20);
+    tm.tm_sec = atoi(str + 23);
+
+    return timegm(&tm);
+}
+
+/**************
+ * file_fresh *
+ **************/
+
+/*
+ * whether the validators the client sent still match this version,
+ * If-None-Match wins over If-Modified-Since when both are present
+ */
+
+int
+file_fresh(struct file* file, struct request* req)
+{
+    char *val, *tok, *comma;
+    int len, tok_len;
+    time_t since;
+
+    val = header_get(req, HDR_IF_NONE_MATCH, &len);
+
+    if (val != NULL) {
+        /* a list of tags, weak ones compare by their opaque part */
+
+        while (len > 0) {
+            comma = memchr(val, ',', len);
+            tok = val;
+            tok_len = comma ? comma - val : len;
+
+            val += tok_len;
+            len -= tok_len;
+            if (comma) {
+                val++;
+                len--;
+            }
+
+            span_trim(&tok, &tok_len);
+            if (tok_len > 2 && tok[0] == 'W' && tok[1] == '/') {
+                tok += 2;
+                tok_len -= 2;
+            }
+
+            if ((tok_len == 1 && tok[0] == '*') ||
+                (tok_len == ETAG_LEN && memcmp(tok, file->etag, ETAG_LEN) == 0))
+                return 1;
+        }
+
+        return 0;
+    }
+
+    val = header_get(req, HDR_IF_MODIFIED_SINCE, &len);
+    if (val == NULL)
+        return 0;
+
+    /* the usual case is our own Last-Modified coming back verbatim */
+
+    if (len == DATE_LEN && memcmp(val, file->last_modified, DATE_LEN) == 0)
+        return 1;
+
+    since = parse_date(val, len);
+
+    return since >= 0 && file->mtime <= since;
+}
+
+/**********
+ * qvalue *
+ **********/
+
+/* the q of an Accept-Encoding entry's parameters, in thousandths */
+
+int
+qvalue(char* params, int len)
+{
+    int q, scale;
+
+    while (len > 0 && (*params == ';' || *params == ' ' || *params == '\t')) {
+        params++;
+        len--;
+    }
+
+    if (len < 2 || (params[0] != 'q' && params[0] != 'Q') || params[1] != '=')
+        return 1000;
+
+    params += 2;
+    len -= 2;
+
+    q = 0;
+    if (len > 0 && *params == '1')
+        q = 1000;
+
+    if (len > 1 && params[1] == '.') {
+        scale = 100;
+        for (int i = 2; i < len && i < 5 && isdigit((unsigned char)params[i]);
+             i++) {
+            q += (params[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+
+    return q > 1000 ? 1000 : q;
+}
+
+/*****************
+ * pick_encoding *
+ *****************/
+
+/* 
+ * the variant of file the client likes best by Accept-Encoding, br
+ * wins ties since it comes out smallest
+ */
+
+enum encoding
+pick_encoding(struct request* req, struct file* file)
+{
+    char *val, *tok, *comma, *semi;
+    int len, tok_len, name_len, star, best_q, q;
+    int qs[N_ENCODINGS];
+    enum encoding best;
+
+    val = header_get(req, HDR_ACCEPT_ENCODING, &len);
+    if (val == NULL)
+        return ENC_IDENTITY;
+
+    star = -1;
+    for (int i = 0; i < N_ENCODINGS; i++)
+        qs[i] = -1;
+
+    while (len > 0) {
+        comma = memchr(val, ',', len);
+        tok = val;
+        tok_len = comma ? comma - val : len;
+
+        val += tok_len;
+        len -= tok_len;
+        if (comma) {
+            val++;
+            len--;
+        }
+
+        span_trim(&tok, &tok_len);
+        semi = memchr(tok, ';', tok_len);
+        name_len = semi ? semi - tok : tok_len;
+        q = semi ? qvalue(semi, tok + tok_len - semi) : 1000;
+        span_trim(&tok, &name_len);
+
+        if (span_is(tok, name_len, "gzip") || span_is(tok, name_len, "x-gzip"))
+            qs[ENC_GZIP] = q;
+        else if (span_is(tok, name_len, "br"))
+            qs[ENC_BR] = q;
+        else if (span_is(tok, name_len, "*"))
+            star = q;
+    }
+
+    best = ENC_IDENTITY;
+    best_q = 1;
+
+    for (int enc = ENC_GZIP; enc < N_ENCODINGS; enc++) {
+        q = qs[enc] >= 0 ? qs[enc] : star;
+        if (file->variants[enc] != NULL && q >= best_q) {
+            best = enc;
+            best_q = q;
+        }
+    }
+
+    return best;
+}
+
+/***************
+ * range_parse *
+ ***************/
+
+/*
+ * the satisfiable byte ranges of a Range value against size into parts,
+ * 0 if none is (416) and -1 if the value is to be ignored, which covers
+ * anything malformed and more than max ranges
+ */
+
+int
+range_parse(char* val, int len, int size, struct part* parts, int max)
+{
+    struct part tmp;
+    char *tok, *comma, *dash;
+    long long first, last;
+    int tok_len, n, n_tok, j, end;
+
+    if (len < 6 || strncasecmp(val, "bytes=", 6) != 0)
+        return -1;
+
+    val += 6;
+    len -= 6;
+    n = 0;
+    n_tok = 0;
+
+    while (len > 0) {
+        comma = memchr(val, ',', len);
+        tok = val;
+        tok_len = comma ? comma - val : len;
+
+        val += tok_len;
+        len -= tok_len;
+        if (comma) {
+            val++;
+            len--;
+        }
+
+        span_trim(&tok, &tok_len);
+        if (tok_len == 0)
+            continue;
+        if (++n_tok > max)
+            return -1;
+
+        dash = memchr(tok, '-', tok_len);
+        if (dash == NULL)
+            return -1;
+
+        /* digits either side, capped well past any size we hold */
+
+        first = -1;
+        for (char* c = tok; c < dash; c++) {
+            if (!isdigit((unsigned char)*c))
+                return -1;
+            first = (first < 0 ? 0 : first) * 10 + (*c - '0');
+            if (first > INT_MAX)
+                first = INT_MAX;
+        }
+
+        last = -1;
+        for (char* c = dash + 1; c < tok + tok_len; c++) {
+            if (!isdigit((unsigned char)*c))
+                return -1;
+            last = (last < 0 ? 0 : last) * 10 + (*c - '0');
+            if (last > INT_MAX)
+                last = INT_MAX;
+        }
+
+        if (first < 0 && last < 0)
+            return -1;
+
+        if (first < 0) {
+            /* a suffix, the final last bytes */
+            if (last == 0)
+                continue;
+            first = last >= size ? 0 : size - last;
+            last = size - 1;
+        } else {
+            if (last >= 0 && last < first)
+                return -1;
+            if (first >= size)
+                continue;
+            if (last < 0 || last >= size)
+                last = size - 1;
+        }
+
+        parts[n].data = NULL;
+        parts[n].off = first;
+        parts[n].len = last - first + 1;
+        n++;
+    }
+
+    if (n_tok == 0)
+        return -1;
+
+    /* 
+     * overlapping or touching ranges merge, sorted by offset, so no byte
+     * goes out twice however the client lists them
+     */
+
+    for (int i = 1; i < n; i++) {
+        tmp = parts[i];
+        for (j = i; j > 0 && parts[j - 1].off > tmp.off; j--)
+            parts[j] = parts[j - 1];
+        parts[j] = tmp;
+    }
+
+    if (n == 0)
+        return 0;
+
+    j = 0;
+    for (int i = 1; i < n; i++) {
+        if (parts[i].off <= parts[j].off + parts[j].len) {
+            end = parts[i].off + parts[i].len;
+            if (end > parts[j].off + parts[j].len)
+                parts[j].len = end - parts[j].off;
+        } else {
+            parts[++j] = parts[i];
+        }
+    }
+
+    return j + 1;
+}
+
+/***************
+ * range_valid *
+ ***************/
+
+/*
+ * whether If-Range, if sent, still names this version, a tag has to
+ * match strongly and a date exactly, otherwise the whole body goes out
+ */
+
+int
+range_valid(struct file* file, struct request* req)
+{
+    char* val;
+    int len;
+
+    val = header_get(req, HDR_IF_RANGE, &len);
+    if (val == NULL)
+        return 1;
+
+    if (len > 0 && val[0] == '"')
+        return len == ETAG_LEN && memcmp(val, file->etag, ETAG_LEN) == 0;
+
+    return len == DATE_LEN && memcmp(val, file->last_modified, DATE_LEN) == 0;
+}
+
+/******************
+ * range_response *
+ ******************/
+
+/*
+ * turns resp into a 206 for the n ranges in parts, or a 416 when n is
+ * 0, with the head built in the arena and the body left as parts, more
+ * than one range goes out as multipart/byteranges
+ */
+
+int
+range_response(struct response* resp, enum mime_type type,
+               struct part* ranges, int n)
+{
+    struct file* file;
+    struct part* parts;
+    char range[64];
+    char *head, *delim, *date;
+    int len, body_len;
+
+    file = resp->file;
+    date = date_now();
+
+    head = arena_alloc(resp->arena, MAX_HEADER_LEN);
+    if (head == NULL)
+        return -1;
+
+    resp->head = head;
+    resp->content_len = 0;
+
+    if (n == 0) {
+        snprintf(range, sizeof(range), "Content-Range: bytes */%d\r\n",
+                 file->size);
+        resp->status = RANGE_NOT_SATISFIABLE;
+        resp->head_len = snprintf(head, MAX_HEADER_LEN, range_fmt,
+                                  resp->status,
+                                  status_to_str(resp->status),
+                                  mime_to_str(type), 0, range, file->etag,
+                                  file->last_modified, date);
+        return 0;
+    }
+
+    resp->status = PARTIAL_CONTENT;
+
+    if (n == 1) {
+        snprintf(range, sizeof(range), "Content-Range: bytes %d-%d/%d\r\n",
+                 ranges[0].off, ranges[0].off + ranges[0].len - 1,
+                 file->size);
+        resp->head_len = snprintf(head, MAX_HEADER_LEN, range_fmt,
+                                  resp->status,
+                                  status_to_str(resp->status),
+                                  mime_to_str(type), ranges[0].len, range,
+                                  file->etag, file->last_modified, date);
+        resp->parts = ranges;
+        resp->n_parts = 1;
+        return 0;
+    }
+
+    parts = arena_alloc(resp->arena, (2 * n + 1) * sizeof(struct part));
+    if (parts == NULL)
+        return -1;
+
+    body_len = 0;
+    for (int i = 0; i < n; i++) {
+        delim = arena_alloc(resp->arena, MAX_HEADER_LEN);
+        if (delim == NULL)
+            return -1;
+
+        len = snprintf(delim, MAX_HEADER_LEN, part_fmt, boundary,
+                       mime_to_str(type), ranges[i].off,
+                       ranges[i].off + ranges[i].len - 1, file->size);
+
+        parts[2 * i].data = delim;
+        parts[2 * i].off = 0;
+        parts[2 * i].len = len;
+        parts[2 * i + 1] = ranges[i];
+        body_len += len + ranges[i].len;
+    }
+
+    delim = arena_alloc(resp->arena, BOUNDARY_LEN + 9);
+    if (delim == NULL)
+        return -1;
+
+    len = snprintf(delim, BOUNDARY_LEN + 9, "\r\n--%s--\r\n", boundary);
+    parts[2 * n].data = delim;
+    parts[2 * n].off = 0;
+    parts[2 * n].len = len;
+    body_len += len;
+
+    snprintf(range, sizeof(range), "multipart/byteranges; boundary=%s",
+             boundary);
+    resp->head_len = snprintf(head, MAX_HEADER_LEN, range_fmt, resp->status,
+                              status_to_str(resp->status), range, body_len,
+                              "", file->etag, file->last_modified, date);
+    resp->parts = parts;
+    resp->n_parts = 2 * n + 1;
+
+    return 0;
+}
+
+/******************
+ * route_response *
+ ******************/
+
+void
+route_response(struct response* resp, struct request* req)
+{
+    struct route* route;
+    struct file* file;
+    struct part* ranges;
+    enum encoding encoding;
+    char* range;
+    int range_len, n;
+
+    route = req->route;
+    file = file_lookup(route);
+    if (file == NULL) {
+        route_error(resp, NOT_FOUND);
+        return;
+    }
+
+    /* 
+     * ranges count bytes of the identity body, a variant lives as long
+     * as its file and both are read under rcu
+     */
+
+    range = header_get(req, HDR_RANGE, &range_len);
+    if (range != NULL && !range_valid(file, req))
+        range = NULL;
+
+    encoding = ENC_IDENTITY;
+    if (range == NULL)
+        encoding = pick_encoding(req, file);
+    if (encoding != ENC_IDENTITY)
+        file = file->variants[encoding];
+
+    resp->status = OK;
+    resp->file = file;
+    resp->content_type = route->type;
+    resp->content = file->data;
+    resp->content_len = file->size;
+
+    /* the client's copy is current, send the head alone */
+
+    if (file_fresh(file, req)) {
+        resp->status = NOT_MODIFIED;
+        resp->content_len = 0;
+        return;
+    }
+
+    if (range != NULL) {
+        ranges = arena_alloc(resp->arena, MAX_RANGES * sizeof(struct part));
+        n = -1;
+        if (ranges != NULL)
+            n = range_parse(range, range_len, file->size, ranges, MAX_RANGES);
+        if (n >= 0 && range_response(resp, route->type, ranges, n) == 0)
+            return;
+
+        /* ignored, or no memory to honor it, the full body still works */
+
+        resp->status = OK;
+        resp->head = NULL;
+        resp->content_len = file->size;
+    }
+
+    /* 
+     * large files go to the socket straight from the page cache, the
+     * version has to outlive this request so the caller gets a ref
+     */
+
+    if (file->size >= SENDFILE_MIN && file->fd >= 0) {
+        file_ref(file);
+        resp->fd = file->fd;
+    } else if (file->size >= SENDFILE_MIN && file->bundled) {
+        /* compiled in pages have no descriptor, send them where they lie */
+
+        ranges = arena_alloc(resp->arena, sizeof(struct part));
+        if (ranges == NULL)
+            return;
+
+        ranges->data = NULL;
+        ranges->off = 0;
+        ranges->len = file->size;
+        resp->parts = ranges;
+        resp->n_parts = 1;
+    }
+}
+
+/*************
+ * hex_value *
+ *************/
+
+int
+hex_value(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+
+    return -1;
+}
+
+/**************
+ * form_close *
+ **************/
+
+/* records the open field, a field without '=' carries nothing */
+
+int
+form_close(struct form* form, int end)
+{
+    struct form_field* fields;
+    int cap;
+
+    if (form->eq == 0)
+        return 0;
+
+    if (form->n_fields == form->cap) {
+        cap = form->cap ? form->cap * 2 : 8;
+        fields = arena_grow(form->arena, form->fields,
+                            form->cap * sizeof(struct form_field),
+                            cap * sizeof(struct form_field));
+        if (fields == NULL)
+            return -1;
+        form->fields = fields;
+        form->cap = cap;
+    }
+
+    fields = &form->fields[form->n_fields++];
+    fields->key = form->field;
+    fields->key_len = form->eq - 1 - form->field;
+    fields->val = form->eq;
+    fields->val_len = end - form->eq;
+
+    return 0;
+}
+
+/*************
+ * form_feed *
+ *************/
+
+/*
+ * takes in the next n raw bytes, already in place after the others,
+ * and decodes as far as they allow, a '%' whose digits have not
+ * arrived yet waits for the next feed
+ */
+
+int
+form_feed(struct form* form, int n)
+{
+    char* data;
+    int c, hi, lo;
+
+    data = form->data;
+    form->len += n;
+
+    while (form->in < form->len) {
+        c = data[form->in];
+
+        if (c == '%') {
+            if (form->len - form->in < 3)
+                break;
+
+            hi = hex_value(data[form->in + 1]);
+            lo = hex_value(data[form->in + 2]);
+            if (hi >= 0 && lo >= 0) {
+                data[form->out++] = hi << 4 | lo;
+                form->in += 3;
+                continue;
+            }
+        }
+
+        form->in++;
+
+        /* delimiters only count raw, an escaped '&' is data */
+
+        if (c == '&') {
+            if (form_close(form, form->out) < 0)
+                return -1;
+            data[form->out++] = '&';
+            form->field = form->out;
+            form->eq = 0;
+        } else if (c == '=' && form->eq == 0) {
+            data[form->out++] = '=';
+            form->eq = form->out;
+        } else {
+            data[form->out++] = c == '+' ? ' ' : c;
+        }
+    }
+
+    return 0;
+}
+
+/************
+ * form_end *
+ ************/
+
+/* 
+ * a dangling '%' is kept as is, closes the last field, the decoded
+ * bytes are not NUL terminated since the next request may follow
+ */
+
+int
+form_end(struct form* form)
+{
+    while (form->in < form->len)
+        form->data[form->out++] = form->data[form->in++];
+
+    return form_close(form, form->out);
+}
+
+/***************
+ * html_entity *
+ ***************/
+
+/* what c has to become inside html, NULL if it can stand as it is */
+
+char*
+html_entity(char c)
+{
+    switch (c) {
+        case '&':
+            return "&amp;";
+        case '<':
+            return "&lt;";
+        case '>':
+            return "&gt;";
+        case '"':
+            return "&quot;";
+        case '\'':
+            return "&#39;";
+        default:
+            return NULL;
+    }
+}
+
+/***************
+ * html_escape *
+ ***************/
+
+/*
+ * a posted value made safe to stand in html, val itself when it has
+ * nothing to escape, else a copy in arena, NULL if that fails
+ */
+
+char*
+html_escape(struct arena* arena, char* val, int len, int* out_len)
+{
+    char *out, *rep;
+    int n;
+
+    n = 0;
+    for (int i = 0; i < len; i++) {
+        rep = html_entity(val[i]);
+        n += rep ? (int)strlen(rep) : 1;
+    }
+
+    *out_len = n;
+    if (n == len)
+        return val;
+
+    out = arena_alloc(arena, n);
+    if (out == NULL)
+        return NULL;
+
+    n = 0;
+    for (int i = 0; i < len; i++) {
+        rep = html_entity(val[i]);
+        if (rep == NULL) {
+            out[n++] = val[i];
+            continue;
+        }
+
+        memcpy(out + n, rep, strlen(rep));
+        n += strlen(rep);
+    }
+
+    return out;
+}
+
+/*****************
+ * parts_flatten *
+ *****************/
+
+/*
+ * copies parts from first on into a single arena part so a response
+ * fits the segments a connection keeps free, file bytes of a mapped
+ * page are read through its descriptor rather than the mapping, -1 if
+ * either fails
+ */
+
+int
+parts_flatten(struct arena* arena, struct file* file, struct part* parts,
+              int n, int first)
+{
+    char* buf;
+    int len, off;
+
+    len = 0;
+    for (int i = first; i < n; i++)
+        len += parts[i].len;
+
+    buf = arena_alloc(arena, len);
+    if (buf == NULL)
+        return -1;
+
+    off = 0;
+    for (int i = first; i < n; i++) {
+        if (parts[i].data != NULL)
+            memcpy(buf + off, parts[i].data, parts[i].len);
+        else if (!file->map_len)
+            memcpy(buf + off, file->data + parts[i].off, parts[i].len);
+        else if (pread(file->fd, buf + off, parts[i].len,
+                       file->fd_off + parts[i].off) != parts[i].len)
+            return -1;
+
+        off += parts[i].len;
+    }
+
+    parts[first].data = buf;
+    parts[first].off = 0;
+    parts[first].len = len;
+
+    return 0;
+}
+
+/*****************
+ * post_response *
+ *****************/
+
+/*
+ * lays the route's page around the posted values in one walk over its
+ * slots, the shared version is only read so posts never contend, page
+ * stretches are parts of the file so a mapped one is never copied, and
+ * a page with nothing to fill is answered as for a get, at most
+ * MAX_PARTS parts like any other response
+ */
+
+void
+post_response(struct response* resp, struct request* req)
+{
+    struct route* route;
+    struct file* file;
+    struct form* form;
+    struct form_field* field;
+    struct slot* slot;
+    struct part* parts;
+    char *data, *head, *val;
+    int n, last, val_len;
+
+    route = req->route;
+    file = NULL;
+    if (route->type == TEXT_HTML)
+        file = file_lookup(route);
+
+    if (file == NULL || file->n_slots == 0) {
+        route_response(resp, req);
+        return;
+    }
+
+    data = (char*)file->data;
+    form = &req->form;
+
+    head = arena_alloc(req->arena, MAX_HEADER_LEN);
+    parts = arena_alloc(req->arena,
+                        (2 * file->n_slots + 1) * sizeof(struct part));
+    if (head == NULL || parts == NULL) {
+        route_response(resp, req);
+        return;
+    }
+
+    resp->status = OK;
+    resp->file = file;
+    resp->content_type = route->type;
+    resp->content_len = 0;
+
+    /* literal up to each filled slot, then the value */
+
+    n = 0;
+    last = 0;
+
+    for (int i = 0; i < file->n_slots; i++) {
+        slot = &file->slots[i];
+
+        for (int j = 0; j < form->n_fields; j++) {
+            field = &form->fields[j];
+            if (field->key_len != slot->key_len ||
+                memcmp(form->data + field->key, data + slot->key,
+                       slot->key_len) != 0)
+                continue;
+
+            /* decoded values may hold markup, it goes in as text */
+
+            val = html_escape(req->arena, form->data + field->val,
+                              field->val_len, &val_len);
+            if (val == NULL) {
+                route_response(resp, req);
+                return;
+            }
+
+            parts[n].data = NULL;
+            parts[n].off = last;
+            parts[n++].len = slot->off - last;
+            parts[n].data = val;
+            parts[n].off = 0;
+            parts[n++].len = val_len;
+
+            resp->content_len += slot->off - last + val_len;
+            last = slot->off;
+            break;
+        }
+    }
+
+    parts[n].data = NULL;
+    parts[n].off = last;
+    parts[n++].len = file->size - last;
+    resp->content_len += file->size - last;
+
+    /* past what a connection has room to queue, the tail goes as one */
+
+    if (n > MAX_PARTS) {
+        if (parts_flatten(req->arena, file, parts, n, MAX_PARTS - 1) < 0) {
+            route_response(resp, req);
+            return;
+        }
+        n = MAX_PARTS;
+    }
+
+    /* the answer is private, no validators of the shared page */
+
+    resp->head = head;
+    resp->head_len = make_header(head, MAX_HEADER_LEN, resp->status,
+                                 resp->content_type, resp->content_len,
+                                 date_now());
+    resp->parts = parts;
+    resp->n_parts = n;
+}
+
+/***************
+ * route_error *
+ ***************/
+
+void
+route_error(struct response* resp, enum status_code status)
+{
+    struct file* file;
+    char *fmt, *content;
+    int len;
+
+    /* the built in page stands in for a missing or unloaded 4xx.html */
+
+    file = error_route ? file_lookup(error_route) : NULL;
+    fmt = file ? (char*)file->data : (char*)error_fmt;
+
+    /* measure, then print into the response's arena */
+
+    len = snprintf(NULL, 0, fmt, status, status_to_str(status));
+    content = len >= 0 ? arena_alloc(resp->arena, len + 1) : NULL;
+
+    if (content == NULL)
+        len = 0;
+    else
+        snprintf(content, len + 1, fmt, status, status_to_str(status));
+
+    resp->status = status;
+    resp->content = (uint8_t*)content;
+    resp->content_len = len;
+    resp->content_type = TEXT_HTML; 
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                            hot reload                             *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * file_bytes *
+ **************/
+
+/* what a version holds in memory, its variants included */
+
+long
+file_bytes(struct file* file)
+{
+    long bytes;
+
+    bytes = file->size;
+    for (int i = 0; i < N_ENCODINGS; i++) {
+        if (file->variants[i] != NULL)
+            bytes += file->variants[i]->size;
+    }
+
+    return bytes;
+}
+
+/***************
+ * file_lookup *
+ ***************/
+
+/*
+ * the route's current version, callers must be rcu online, a miss
+ * loads the bare page right here and races any other reactor to
+ * publish it, its variants follow from view_encode, NULL only if the
+ * page cannot be read
+ */
+
+struct file*
+file_lookup(struct route* route)
+{
+    struct file *file, *cur;
+    unsigned tick;
+
+    /* 
+     * no locked adds, a lost hit only blurs the ranking, and used is
+     * written once a tick however hot the page is
+     */
+
+    atomic_store_explicit(&route->hits,
+                          atomic_load_explicit(&route->hits,
+                                               memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+
+    tick = atomic_load_explicit(&view_clock, memory_order_relaxed);
+    if (atomic_load_explicit(&route->used, memory_order_relaxed) != tick)
+        atomic_store_explicit(&route->used, tick, memory_order_relaxed);
+
+    file = atomic_load_explicit(&route->file, memory_order_acquire);
+    if (file != NULL)
+        return file;
+
+    file = file_load(route, 0);
+    if (file == NULL)
+        return NULL;
+
+    /* the loser's copy was never seen by anyone */
+
+    cur = NULL;
+    if (!atomic_compare_exchange_strong(&route->file, &cur, file)) {
+        file_put(file);
+        return cur;
+    }
+
+    atomic_fetch_add(&view_bytes, file_bytes(file));
+
+    if (route->entry == NULL && mime_compresses(route->type) &&
+        file->size >= COMPRESS_MIN)
+        atomic_store(&route->pending, 1);
+
+    return file;
+}
+
+/************
+ * file_ref *
+ ************/
+
+/* pins a version loaded while rcu online */
+
+void
+file_ref(struct file* file)
+{
+    atomic_fetch_add_explicit(&file->refs, 1, memory_order_relaxed);
+}
+
+/************
+ * file_put *
+ ************/
+
+void
+file_put(struct file* file)
+{
+    if (atomic_fetch_sub_explicit(&file->refs, 1, memory_order_acq_rel) != 1)
+        return;
+
+    if (file->fd >= 0 && !file->bundled)
+        close(file->fd);
+    for (int i = 0; i < N_ENCODINGS; i++) {
+        if (file->variants[i] != NULL)
+            file_put(file->variants[i]);
+    }
+
+    if (file->map_len)
+        munmap(file->data, file->map_len);
+    else if (!file->bundled)
+        free(file->data);
+    free(file->header);
+    free(file->slots);
+    free(file);
+}
+
+/****************
+ * file_publish *
+ ****************/
+
+/* 
+ * makes file the route's current version, NULL evicts it, readers
+ * still looking at the old one keep it until view_reclaim has waited
+ * them out
+ */
+
+void
+file_publish(struct route* route, struct file* file)
+{
+    struct file* old;
+
+    if (file != NULL)
+        atomic_fetch_add(&view_bytes, file_bytes(file));
+
+    old = atomic_exchange(&route->file, file);
+    if (old != NULL)
+        file_retire(old);
+}
+
+/***************
+ * file_retire *
+ ***************/
+
+/* queues an unpublished version to be freed after a grace period */
+
+void
+file_retire(struct file* old)
+{
+    struct file* head;
+
+    atomic_fetch_sub(&view_bytes, file_bytes(old));
+
+    head = atomic_load(&retired);
+    do {
+        old->next = head;
+    } while (!atomic_compare_exchange_weak(&retired, &head, old));
+}
+
+/***************
+ * view_encode *
+ ***************/
+
+/*
+ * republishes every page a request loaded bare with its compressed
+ * variants, read and encoded on the watcher so no request pays for
+ * them, requests get the identity version until then
+ */
+
+void
+view_encode()
+{
+    struct file *cur, *file;
+
+    for (int i = 0; i < n_routes; i++) {
+        if (!atomic_exchange(&view[i].pending, 0))
+            continue;
+
+        /* evicted meanwhile, it starts over on its next request */
+
+        cur = atomic_load(&view[i].file);
+        if (cur == NULL)
+            continue;
+
+        file = file_load(&view[i], 1);
+        if (file == NULL)
+            continue;
+
+        /* 
+         * reactors only ever publish over NULL and versions are only
+         * freed on this thread, so cur is still what it was or gone
+         */
+
+        atomic_fetch_add(&view_bytes, file_bytes(file));
+        if (!atomic_compare_exchange_strong(&view[i].file, &cur, file)) {
+            atomic_fetch_sub(&view_bytes, file_bytes(file));
+            file_put(file);
+            continue;
+        }
+
+        file_retire(cur);
+    }
+}
+
+/**************
+ * view_evict *
+ **************/
+
+/*
+ * unpublishes the least recently used pages, fewest hits first among
+ * those used in the same tick, until the view fits its budget, they
+ * load again on their next request
+ */
+
+void
+view_evict()
+{
+    struct route* lru;
+    unsigned used, lru_used;
+
+    atomic_fetch_add(&view_clock, 1);
+
+    if (view_budget == 0)
+        return;
+
+    while (atomic_load(&view_bytes) > view_budget) {
+        lru = NULL;
+        lru_used = 0;
+
+        for (int i = 0; i < n_routes; i++) {
+            if (atomic_load(&view[i].file) == NULL)
+                continue;
+
+            used = atomic_load(&view[i].used);
+            if (lru == NULL || used < lru_used ||
+                (used == lru_used &&
+                 atomic_load(&view[i].hits) < atomic_load(&lru->hits))) {
+                lru = &view[i];
+                lru_used = used;
+            }
+        }
+
+        if (lru == NULL)
+            break;
+
+        file_publish(lru, NULL);
+    }
+}
+
+/****************
+ * view_reclaim *
+ ****************/
+
+/* 
+ * encodes pages loaded bare, trims the view to its budget, then drops
+ * the view's ref on every retired version after a grace period
+ */
+
+void
+view_reclaim()
+{
+    struct file *file, *next;
+
+    view_encode();
+    view_evict();
+
+    file = atomic_exchange(&retired, NULL);
+    if (file == NULL)
+        return;
+
+    rcu_synchronize();
+
+    for (; file != NULL; file = next) {
+        next = file->next;
+        file_put(file);
+    }
+}
+
+/**************
+ * view_watch *
+ **************/
+
+/* 
+ * watches every directory holding a page and republishes a page when
+ * an editor finishes writing or renames over it, never returns unless
+ * inotify is unavailable, new files need a restart to get a route
+ */
+
+int
+view_watch()
+{
+    struct inotify_event* ev;
+    struct pollfd pfd;
+    struct file* file;
+    char buf[WATCH_BUF_LEN] __attribute__((aligned(8)));
+    char **dirs, **dirs_new, *path, *page, *slash;
+    int fd, wd, n_bytes, max_wd;
+
+    fd = inotify_init1(IN_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "[ERROR] inotify_init1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* wd -> directory under view_loc, each directory watched once */
+
+    max_wd = 0;
+    dirs = NULL;
+
+    for (int i = 0; i < n_routes; i++) {
+        page = strdup(view[i].page);
+        slash = strrchr(page, '/');
+        *slash = 0;
+
+        if (asprintf(&path, "%s%s", view_loc, page) < 0) {
+            free(page);
+            continue;
+        }
+
+        wd = inotify_add_watch(fd, path, IN_CLOSE_WRITE | IN_MOVED_TO);
+        free(path);
+
+        if (wd < 0 || (wd < max_wd && dirs[wd] != NULL)) {
+            free(page);
+            continue;
+        }
+
+        if (wd >= max_wd) {
+            dirs_new = realloc(dirs, (wd + 1) * sizeof(char*));
+            if (dirs_new == NULL) {
+                free(page);
+                continue;
+            }
+
+            dirs = dirs_new;
+            memset(dirs + max_wd, 0, (wd + 1 - max_wd) * sizeof(char*));
+            max_wd = wd + 1;
+        }
+
+        dirs[wd] = page;
+    }
+
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    while (1) {
+        view_reclaim();
+
+        if (poll(&pfd, 1, RECLAIM_MS) <= 0)
+            continue;
+
+        n_bytes = read(fd, buf, WATCH_BUF_LEN);
+        if (n_bytes <= 0)
+            continue;
+
+        for (char* p = buf; p < buf + n_bytes;
+             p += sizeof(struct inotify_event) + ev->len) {
+            ev = (struct inotify_event*)p;
+
+            if (ev->len == 0 || ev->wd >= max_wd || dirs[ev->wd] == NULL)
+                continue;
+
+            if (asprintf(&page, "%s/%s", dirs[ev->wd], ev->name) < 0)
+                continue;
+
+            for (int i = 0; i < n_routes; i++) {
+                if (strcmp(view[i].page, page) != 0)
+                    continue;
+
+                atomic_store(&view[i].pending, 0);
+                file = file_load(&view[i], 1);
+                if (file != NULL) {
+                    file_publish(&view[i], file);
+                    printf("[SERVER] reloaded %s\n", page);
+                }
+            }
+
+            free(page);
+        }
+    }
+
+    return 0;
 }
 
 /*********************************************************************
@@ -580,30 +3093,62 @@ route_error(struct response* resp, enum status_code status)
 void
 view_free()
 {
-    int n_pages;
     struct file* file;
 
-    n_pages = sizeof(view) / sizeof(struct route);
+    view_reclaim();
 
-    for (int i = 0; i < n_pages; i++) {
-        file = &view[i].file;
+    for (int i = 0; i < n_routes; i++) {
+        file = atomic_exchange(&view[i].file, NULL);
         
-        if (file == NULL)
-            continue;
+        if (file != NULL)
+            file_put(file);
 
-        fclose(file->fp);
-        free(file->data);
+        /* discovered routes share one string for resource and page */
+
+        if (view_cap)
+            free(view[i].page);
     }
+
+    if (view_cap)
+        free(view);
+
+    free(routes);
+    routes = NULL;
+}
+
+/************
+ * buf_free *
+ ************/
+
+void
+buf_free(struct buf* buf)
+{
+    struct pool* pool;
+
+    pool = buf->pool;
+
+    if (pool != NULL && buf->data != NULL && buf->cap <= POOL_MAX)
+        pool_put(pool, buf->data, buf->cap);
+    else
+        free(buf->data);
+
+    memset(buf, 0, sizeof(struct buf));
+    buf->pool = pool;
 }
 
 /****************
  * request_free *
  ****************/
 
+/* the memory is the arena's, it goes when the arena is reset */
+
 void 
 request_free(struct request* req)
 {
-
+    req->content = NULL;
+    req->headers = NULL;
+    req->headers_cap = 0;
+    memset(&req->form, 0, sizeof(struct form));
 }
 
 /*****************
@@ -613,7 +3158,10 @@ request_free(struct request* req)
 void 
 response_free(struct response* resp)
 {
-
+    resp->content = NULL;
+    resp->head = NULL;
+    resp->parts = NULL;
+    resp->n_parts = 0;
 }
 
 
@@ -2,8 +2,20 @@
 #define HTTP_H
 
 #include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "pool.h"
 
 #define MAX_URI_LEN 200
+#define DATE_LEN    29                      /* IMF-fixdate, RFC 7231 */
+#define ETAG_LEN    18                      /* 16 hex digits in quotes */
+#define MAX_RANGES  8                       /* more and Range is ignored */
+#define MAX_PARTS   (2 * MAX_RANGES + 1)    /* with multipart delimiters */
+#define SENDFILE_MIN (16 * 1024)            /* smaller bodies get copied */
 
 /*********************************************************************
  *                                                                   *
@@ -18,8 +30,32 @@
 enum mime_type {
     TEXT_HTML    = 0x00000000A,
     TEXT_CSS     = 0x00000000B,
+    TEXT_PLAIN   = 0x00000000C,
+    TEXT_JS      = 0x00000000D,
     IMAGE_PNG    = 0x000000024,
+    IMAGE_JPEG   = 0x000000025,
+    IMAGE_GIF    = 0x000000026,
+    IMAGE_SVG    = 0x000000027,
+    IMAGE_ICON   = 0x000000028,
+    IMAGE_WEBP   = 0x000000029,
     APP_XFORM    = 0x000000014,
+    APP_JSON     = 0x000000015,
+    APP_PDF      = 0x000000016,
+    APP_OCTET    = 0x000000017,
+    FONT_WOFF2   = 0x000000030,
+};
+
+/************
+ * encoding *
+ ************/
+
+/* content codings we keep precompressed variants in, best last */
+
+enum encoding {
+    ENC_IDENTITY,
+    ENC_GZIP,
+    ENC_BR,
+    N_ENCODINGS
 };
 
 /***************
@@ -37,23 +73,173 @@ enum method_type {
 
 enum status_code {
     OK              = 200,
+    PARTIAL_CONTENT = 206,
+    NOT_MODIFIED    = 304,
     BAD_REQUEST     = 400,
-    NOT_FOUND       = 404
+    NOT_FOUND       = 404,
+    RANGE_NOT_SATISFIABLE = 416
+};
+
+/*******
+ * buf *
+ *******/
+
+/* 
+ * growable byte buffer, with a pool it takes that pool's chunks while
+ * it fits in POOL_MAX and only goes to the heap past that
+ */
+
+struct buf {
+    char* data;
+    int len, cap;
+    struct pool* pool;
+};
+
+/***************
+ * parse_state *
+ ***************/
+
+/* where the incremental parser stopped */
+
+enum parse_state {
+    PARSE_LINE,
+    PARSE_HEADERS,
+    PARSE_BODY,
+    PARSE_END
+};
+
+/****************
+ * parse_result *
+ ****************/
+
+enum parse_result {
+    PARSE_DONE,
+    PARSE_AGAIN,                            /* feed more bytes */
+    PARSE_ERROR
+};
+
+/*************
+ * header_id *
+ *************/
+
+/* headers with a fixed slot in every request, see header_names */
+
+enum header_id {
+    HDR_HOST,
+    HDR_CONNECTION,
+    HDR_CONTENT_TYPE,
+    HDR_CONTENT_LENGTH,
+    HDR_TRANSFER_ENCODING,
+    HDR_ACCEPT,
+    HDR_ACCEPT_ENCODING,
+    HDR_IF_NONE_MATCH,
+    HDR_IF_MODIFIED_SINCE,
+    HDR_RANGE,
+    HDR_IF_RANGE,
+    HDR_USER_AGENT,
+    HDR_REFERER,
+    HDR_COOKIE,
+    N_HEADERS
+};
+
+/**********
+ * header *
+ **********/
+
+/* offsets into the request as it sits in the receive buffer */
+
+struct span {
+    int off;                                /* 0 if absent */
+    int len;
+};
+
+struct header {
+    struct span name;
+    struct span val;                        /* blanks trimmed */
+};
+
+/********
+ * form *
+ ********/
+
+/* a urlencoded field, offsets are into the decoded body */
+
+struct form_field {
+    int key;
+    int key_len;
+    int val;
+    int val_len;
+};
+
+/*
+ * an x-www-form-urlencoded body decoded where it was received as it is
+ * fed, %xx and '+' shrink so the decoded bytes never overtake the raw
+ * ones, fields are views into it
+ */
+
+struct form {
+    char* data;                             /* raw, then decoded, bytes */
+    int len;                                /* raw bytes fed so far */
+    int in;                                 /* raw bytes decoded */
+    int out;                                /* decoded bytes */
+    int field;                              /* start of the open field */
+    int eq;                                 /* just past its '=', 0 if none */
+
+    struct form_field* fields;
+    int n_fields;
+    int cap;
+    struct arena* arena;                    /* fields come from here */
 };
 
 /***********
  * request *
  ***********/
 
-/* a parsed HTTP request */
+/* 
+ * a parsed HTTP request, offsets are relative to the start of the
+ * request in the caller's buffer so the buffer may move between feeds
+ */
 
 struct request {
     enum method_type method;                /* request line */
     char uri[MAX_URI_LEN];
+    struct route* route;                    /* NULL if uri is unknown */
+    int minor;                              /* HTTP/1.x */
+
+    int keep_alive;                         /* headers */
 
     int content_len;                           /* body */
     enum mime_type content_type;
-    uint8_t* content;
+    uint8_t* content;                       /* in the parsed data */
+    struct form form;                       /* urlencoded content */
+
+    enum parse_state state;                 /* parser */
+    enum status_code status;
+    int line;                               /* start of current line */
+    int scan;                               /* searched for \n up to */
+    int colon;                              /* first ':' in line, 0 if none */
+
+    char* data;                             /* buffer of the last feed */
+    struct header* headers;                 /* every header, in order */
+    int n_headers;
+    int headers_cap;
+    struct span known[N_HEADERS];           /* first of each known one */
+    int body;                               /* start of the body */
+    int len;                                /* bytes in whole request */
+
+    struct arena* arena;                    /* all of its scratch memory */
+};
+
+/********
+ * part *
+ ********/
+
+/* a piece of a ranged body, bytes to copy or a stretch of resp->file */
+
+struct part {
+    char* data;                             /* NULL, it is file bytes */
+    int off;                                /* into the file */
+    int len;
 };
 
 /************
@@ -64,32 +250,111 @@ struct request {
 
 struct response {
     enum status_code status;
+    int keep_alive;                         /* connection */
+    int minor;                              /* client's HTTP/1.x */
 
     int content_len;
     enum mime_type content_type;
     uint8_t* content;
+    int fd;                                 /* >= 0, send body from file */
+
+    struct file* file;                      /* set, use its prebuilt head */
+    char* head;                             /* set, use this head instead */
+    int head_len;
+
+    struct part* parts;                     /* set, body is these in order */
+    int n_parts;
+
+    struct arena* arena;                    /* same as its request's */
+};
+
+/********
+ * slot *
+ ********/
+
+/* where a page takes a posted value, the field name is id="..." */
+
+struct slot {
+    int off;                                /* value goes before data[off] */
+    int key;                                /* name within data */
+    int key_len;
 };
 
 /********
  * file *
  ********/
 
+/* 
+ * an immutable snapshot of a page, a reload publishes a new one in its
+ * route, anything that outlives the request it was looked up for (a
+ * queued sendfile) pins it with a ref
+ */
+
 struct file {
-    FILE* fp;
     uint8_t* data;
+    size_t map_len;                         /* > 0, data is mapped */
+    int bundled;                            /* data and fd are borrowed */
     int fd;
+    off_t fd_off;                           /* where data starts in fd */
     int size;
+
+    char* header;                           /* prebuilt 200 head */
+    int header_len;
+    int date_off;                           /* where to patch Date */
+
+    char* nm_header;                        /* prebuilt 304 head, same buf */
+    int nm_header_len;
+    int nm_date_off;
+
+    time_t mtime;                           /* validators */
+    char last_modified[DATE_LEN + 1];
+    char etag[ETAG_LEN + 1];                /* strong, hash of data */
+
+    struct slot* slots;                     /* html only, in page order */
+    int n_slots;
+
+    enum encoding encoding;                 /* of data */
+    struct file* variants[N_ENCODINGS];     /* compressed copies, or NULL */
+
+    atomic_int refs;
+    struct file* next;                      /* retire list */
 };
 
 /*********
  * route *
  *********/
 
+/* 
+ * file may only be loaded by an rcu reader, see file_lookup, it stays
+ * NULL until the first request and goes back to NULL when evicted
+ */
+
 struct route {
     char* resource;
     char* page;
-    struct file file;
+    struct file* _Atomic file;
     enum mime_type type;
+    struct bundle_entry* entry;             /* set, page is in the bundle */
+
+    atomic_uint hits;                       /* advisory, may lose some */
+    atomic_uint used;                       /* view_clock of the last hit */
+    atomic_int pending;                     /* set, variants still to come */
+};
+
+/**************
+ * route_slot *
+ **************/
+
+/* 
+ * an entry in the open addressed table uris are resolved through,
+ * the key may be a prefix of the route's page for directory indexes
+ */
+
+struct route_slot {
+    uint32_t hash;
+    char* key;
+    int key_len;
+    struct route* route;
 };
 
 /*********************************************************************
@@ -100,7 +365,10 @@ struct route {
 
 /* holds file data associated with pages in the website */
 
-extern struct route view[];
+extern struct route* view;
+extern int n_routes;
+extern int view_huge;
+extern long view_budget;
 
 /*********************************************************************
  *                                                                   *
@@ -108,20 +376,59 @@ extern struct route view[];
  *                                                                   *
  *********************************************************************/
 
-void request_init(struct request* req);
-enum status_code parse_request(struct request* req, char* data);
+void request_init(struct request* req, struct arena* arena);
+enum parse_result parse_request(struct request* req, char* data, int len);
 
-void response_init(struct response* resp);
-void make_response(struct response* resp, char** data, int* len);
+void response_init(struct response* resp, struct arena* arena);
+int make_response(struct response* resp, struct buf* out);
+int buf_reserve(struct buf* buf, int len);
+void buf_free(struct buf* buf);
 
 void request_free(struct request* req);
 void response_free(struct response* resp);
 
 void route_response(struct response* resp, struct request* req);
-void handle_post(struct request* req, char* html, char** res);
+void post_response(struct response* resp, struct request* req);
 void route_error(struct response* resp, enum status_code status);
 
+void date_update();
+char* date_now();
+
+int router_init();
+struct route* view_route(char* resource, int len);
+
+enum mime_type mime_from_ext(char* path);
+char* mime_to_str(enum mime_type type);
+char* header_get(struct request* req, enum header_id id, int* len);
+
+struct file* file_make(struct route* route, uint8_t* data, int size,
+                       size_t map_len, struct stat* st);
+void file_tag(struct file* file, struct stat* st);
+int file_fresh(struct file* file, struct request* req);
+int file_encode(struct file* file, struct route* route, char* path);
+enum encoding pick_encoding(struct request* req, struct file* file);
+struct file* file_load(struct route* route, int encode);
+int file_head(struct file* file, enum mime_type type);
+struct file* file_lookup(struct route* route);
+void file_ref(struct file* file);
+void file_put(struct file* file);
+void file_publish(struct route* route, struct file* file);
+void file_retire(struct file* old);
+int template_compile(struct file* file);
+
+int form_feed(struct form* form, int n);
+int form_end(struct form* form);
+char* html_entity(char c);
+char* html_escape(struct arena* arena, char* val, int len, int* out_len);
+int parts_flatten(struct arena* arena, struct file* file, struct part* parts,
+                  int n, int first);
+
+int view_discover();
 int view_init();
+int view_watch();
+void view_evict();
+void view_encode();
+void view_reclaim();
 void view_free();
 
 #endif    /* HTTP_H */
\ No newline at end of file
@@ -0,0 +1,87 @@
+#include <stdlib.h>
+#include "pool.h"
+
+/*********************************************************************
+ *                                                                   *
+ *                            operations                             *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * pool_class *
+ **************/
+
+/* smallest class that holds size, -1 if none does */
+
+int
+pool_class(int size)
+{
+    int cap;
+
+    cap = POOL_MIN;
+    for (int i = 0; i < POOL_CLASSES; i++) {
+        if (size <= cap)
+            return i;
+        cap *= 4;
+    }
+
+    return -1;
+}
+
+/************
+ * pool_get *
+ ************/
+
+/* a chunk of at least size bytes, its real size goes in cap */
+
+void*
+pool_get(struct pool* pool, int size, int* cap)
+{
+    struct pool_chunk* chunk;
+    char* slab;
+    int class, chunk_size;
+
+    class = pool_class(size);
+    if (class < 0)
+        return NULL;
+
+    chunk_size = POOL_MIN << (2 * class);
+
+    /* out of chunks, carve a new slab into the list */
+
+    if (pool->free[class] == NULL) {
+        slab = malloc((size_t)POOL_SLAB * chunk_size);
+        if (slab == NULL)
+            return NULL;
+
+        for (int i = POOL_SLAB - 1; i >= 0; i--) {
+            chunk = (struct pool_chunk*)(slab + (size_t)i * chunk_size);
+            chunk->next = pool->free[class];
+            pool->free[class] = chunk;
+        }
+    }
+
+    chunk = pool->free[class];
+    pool->free[class] = chunk->next;
+    *cap = chunk_size;
+
+    return chunk;
+}
+
+/************
+ * pool_put *
+ ************/
+
+/* cap has to be what pool_get handed out */
+
+void
+pool_put(struct pool* pool, void* data, int cap)
+{
+    struct pool_chunk* chunk;
+    int class;
+
+    class = pool_class(cap);
+    chunk = data;
+    chunk->next = pool->free[class];
+    pool->free[class] = chunk;
+}
@@ -0,0 +1,47 @@
+#ifndef POOL_H
+#define POOL_H
+
+#define POOL_CLASSES    3
+#define POOL_MIN        (4 * 1024)          /* 4K, 16K, 64K */
+#define POOL_MAX        (64 * 1024)
+#define POOL_SLAB       16                  /* chunks carved per malloc */
+
+/*********************************************************************
+ *                                                                   *
+ *                        struct definitions                         *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * pool_chunk *
+ **************/
+
+/* a free chunk, the link lives in the chunk itself */
+
+struct pool_chunk {
+    struct pool_chunk* next;
+};
+
+/********
+ * pool *
+ ********/
+
+/* 
+ * size classed free lists, chunks are carved from slabs and only ever
+ * go back to their list, one per reactor so it needs no locking
+ */
+
+struct pool {
+    struct pool_chunk* free[POOL_CLASSES];
+};
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+void* pool_get(struct pool* pool, int size, int* cap);
+void pool_put(struct pool* pool, void* data, int cap);
+
+#endif    /* POOL_H */
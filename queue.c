@@ -0,0 +1,137 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include "queue.h"
+
+/*********************************************************************
+ *                                                                   *
+ *                            initializers                           *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * queue_init *
+ **************/
+
+/* size must be a power of two */
+
+int
+queue_init(struct queue* queue, size_t size)
+{
+    if (size < 2 || (size & (size - 1)) != 0)
+        return -1;
+
+    queue->cells = malloc(size * sizeof(struct queue_cell));
+    if (queue->cells == NULL)
+        return -1;
+
+    for (size_t i = 0; i < size; i++)
+        atomic_init(&queue->cells[i].seq, i);
+
+    queue->mask = size - 1;
+    atomic_init(&queue->tail, 0);
+    atomic_init(&queue->head, 0);
+
+    return 0;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                            operations                             *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * queue_push *
+ **************/
+
+/* returns -1 if the ring is full */
+
+int
+queue_push(struct queue* queue, int val)
+{
+    struct queue_cell* cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            /* slot is free for this lap, try to claim it */
+            if (atomic_compare_exchange_weak_explicit(&queue->tail, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->tail, memory_order_relaxed);
+        }
+    }
+
+    cell->val = val;
+    atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+    return 0;
+}
+
+/*************
+ * queue_pop *
+ *************/
+
+/* returns -1 if the ring is empty */
+
+int
+queue_pop(struct queue* queue, int* val)
+{
+    struct queue_cell* cell;
+    size_t pos, seq;
+    intptr_t diff;
+
+    pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+
+    while (1) {
+        cell = &queue->cells[pos & queue->mask];
+        seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        diff = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (diff == 0) {
+            /* slot holds a value for this lap, try to take it */
+            if (atomic_compare_exchange_weak_explicit(&queue->head, &pos,
+                    pos + 1, memory_order_relaxed, memory_order_relaxed))
+                break;
+        } else if (diff < 0) {
+            return -1;
+        } else {
+            pos = atomic_load_explicit(&queue->head, memory_order_relaxed);
+        }
+    }
+
+    *val = cell->val;
+
+    /* hand the slot back to producers for the next lap */
+    atomic_store_explicit(&cell->seq, pos + queue->mask + 1,
+                          memory_order_release);
+
+    return 0;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                            destructors                            *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * queue_free *
+ **************/
+
+void
+queue_free(struct queue* queue)
+{
+    free(queue->cells);
+    queue->cells = NULL;
+}
@@ -0,0 +1,56 @@
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CACHE_LINE    64
+
+/*********************************************************************
+ *                                                                   *
+ *                        struct definitions                         *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * queue_cell *
+ **************/
+
+/* a slot in the ring, seq says whose turn it is to touch val */
+
+struct queue_cell {
+    atomic_size_t seq;
+    int val;
+};
+
+/*********
+ * queue *
+ *********/
+
+/* 
+ * bounded lock-free multi-producer multi-consumer ring of ints,
+ * head and tail live on their own cache lines so producers and
+ * consumers do not false share
+ */
+
+struct queue {
+    struct queue_cell* cells;
+    size_t mask;
+
+    _Alignas(CACHE_LINE) atomic_size_t tail;      /* next push */
+    _Alignas(CACHE_LINE) atomic_size_t head;      /* next pop */
+};
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+int queue_init(struct queue* queue, size_t size);
+void queue_free(struct queue* queue);
+
+int queue_push(struct queue* queue, int val);
+int queue_pop(struct queue* queue, int* val);
+
+#endif    /* QUEUE_H */
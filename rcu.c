@@ -0,0 +1,118 @@
+#include <time.h>
+#include "rcu.h"
+
+/*********************************************************************
+ *                                                                   *
+ *                           global data                             *
+ *                                                                   *
+ *********************************************************************/
+
+/* 
+ * quiescent state based reclamation, readers announce when they may
+ * hold a protected pointer and writers wait out everyone who might
+ */
+
+atomic_ulong rcu_gp = 1;
+
+struct rcu_reader* rcu_readers[MAX_RCU_READERS];
+atomic_int rcu_n_readers;
+
+/*********************************************************************
+ *                                                                   *
+ *                            initializers                           *
+ *                                                                   *
+ *********************************************************************/
+
+/****************
+ * rcu_register *
+ ****************/
+
+/* readers register once, before anyone calls rcu_synchronize */
+
+int
+rcu_register(struct rcu_reader* reader)
+{
+    int n;
+
+    n = atomic_fetch_add(&rcu_n_readers, 1);
+    if (n >= MAX_RCU_READERS) {
+        atomic_fetch_sub(&rcu_n_readers, 1);
+        return -1;
+    }
+
+    atomic_init(&reader->ctr, 0);
+    rcu_readers[n] = reader;
+
+    return 0;
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                              readers                              *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * rcu_online *
+ **************/
+
+/* call before touching protected pointers */
+
+void
+rcu_online(struct rcu_reader* reader)
+{
+    atomic_store(&reader->ctr, atomic_load(&rcu_gp));
+
+    /* our ctr must be visible before we load any pointer */
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+/***************
+ * rcu_offline *
+ ***************/
+
+/* call once no protected pointer is held, e.g. before blocking */
+
+void
+rcu_offline(struct rcu_reader* reader)
+{
+    atomic_store_explicit(&reader->ctr, 0, memory_order_release);
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                              writers                              *
+ *                                                                   *
+ *********************************************************************/
+
+/*******************
+ * rcu_synchronize *
+ *******************/
+
+/* 
+ * returns once every reader that could have seen a pointer unpublished
+ * before the call has gone offline or come back online since
+ */
+
+void
+rcu_synchronize()
+{
+    struct timespec nap;
+    unsigned long gp, ctr;
+    int n;
+
+    nap.tv_sec = 0;
+    nap.tv_nsec = 1000000;
+
+    gp = atomic_fetch_add(&rcu_gp, 1) + 1;
+    n = atomic_load(&rcu_n_readers);
+
+    for (int i = 0; i < n; i++) {
+        while (1) {
+            ctr = atomic_load(&rcu_readers[i]->ctr);
+            if (ctr == 0 || ctr >= gp)
+                break;
+            nanosleep(&nap, NULL);
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#ifndef RCU_H
+#define RCU_H
+
+#include <stdatomic.h>
+
+#define MAX_RCU_READERS    256
+
+/*********************************************************************
+ *                                                                   *
+ *                        struct definitions                         *
+ *                                                                   *
+ *********************************************************************/
+
+/**************
+ * rcu_reader *
+ **************/
+
+/* 
+ * a thread that reads rcu protected pointers, ctr is 0 while it holds
+ * none (offline) and otherwise the grace period it came online in
+ */
+
+struct rcu_reader {
+    _Alignas(64) atomic_ulong ctr;
+};
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+int rcu_register(struct rcu_reader* reader);
+
+void rcu_online(struct rcu_reader* reader);
+void rcu_offline(struct rcu_reader* reader);
+
+void rcu_synchronize();
+
+#endif    /* RCU_H */
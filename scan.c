@@ -0,0 +1,158 @@
+#include <string.h>
+#include "scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+/*********************************************************************
+ *                                                                   *
+ *                           global data                             *
+ *                                                                   *
+ *********************************************************************/
+
+char* (*scan_line)(char* p, char* end, char** colon) = scan_scalar;
+
+/*********************************************************************
+ *                                                                   *
+ *                             scanners                              *
+ *                                                                   *
+ *********************************************************************/
+
+/***************
+ * scan_scalar *
+ ***************/
+
+/* any cpu, also finishes the tails the vector versions leave */
+
+char*
+scan_scalar(char* p, char* end, char** colon)
+{
+    char* eol;
+
+    eol = memchr(p, '\n', end - p);
+
+    if (*colon == NULL)
+        *colon = memchr(p, ':', (eol ? eol : end) - p);
+
+    return eol;
+}
+
+#ifdef SCAN_X86
+
+/**************
+ * scan_sse42 *
+ **************/
+
+/* 
+ * 16 bytes a step, on the cpus that have sse4.2 a compare per
+ * delimiter beats pcmpistri's any-of match, which is microcoded slow
+ */
+
+__attribute__((target("sse4.2")))
+char*
+scan_sse42(char* p, char* end, char** colon)
+{
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i col = _mm_set1_epi8(':');
+    __m128i chunk;
+    unsigned lf_mask, col_mask;
+
+    while (end - p >= 16) {
+        chunk = _mm_loadu_si128((__m128i*)p);
+        lf_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, lf));
+        col_mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, col));
+
+        /* only a colon ahead of the line end counts */
+
+        if (lf_mask)
+            col_mask &= (lf_mask & -lf_mask) - 1;
+
+        if (col_mask && *colon == NULL)
+            *colon = p + __builtin_ctz(col_mask);
+
+        if (lf_mask)
+            return p + __builtin_ctz(lf_mask);
+
+        p += 16;
+    }
+
+    return scan_scalar(p, end, colon);
+}
+
+/*************
+ * scan_avx2 *
+ *************/
+
+/* 32 bytes a step, one compare per delimiter */
+
+__attribute__((target("avx2")))
+char*
+scan_avx2(char* p, char* end, char** colon)
+{
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i col = _mm256_set1_epi8(':');
+    __m256i chunk;
+    unsigned lf_mask, col_mask;
+
+    while (end - p >= 32) {
+        chunk = _mm256_loadu_si256((__m256i*)p);
+        lf_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, lf));
+        col_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, col));
+
+        /* only a colon ahead of the line end counts */
+
+        if (lf_mask)
+            col_mask &= (lf_mask & -lf_mask) - 1;
+
+        if (col_mask && *colon == NULL)
+            *colon = p + __builtin_ctz(col_mask);
+
+        if (lf_mask)
+            return p + __builtin_ctz(lf_mask);
+
+        p += 32;
+    }
+
+    return scan_scalar(p, end, colon);
+}
+
+#else
+
+char*
+scan_sse42(char* p, char* end, char** colon)
+{
+    return scan_scalar(p, end, colon);
+}
+
+char*
+scan_avx2(char* p, char* end, char** colon)
+{
+    return scan_scalar(p, end, colon);
+}
+
+#endif    /* SCAN_X86 */
+
+/*********************************************************************
+ *                                                                   *
+ *                            initializers                           *
+ *                                                                   *
+ *********************************************************************/
+
+/*************
+ * scan_init *
+ *************/
+
+void
+scan_init()
+{
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx2"))
+        scan_line = scan_avx2;
+    else if (__builtin_cpu_supports("sse4.2"))
+        scan_line = scan_sse42;
+#endif
+}
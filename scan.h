@@ -0,0 +1,24 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+/*********************************************************************
+ *                                                                   *
+ *                            functions                              *
+ *                                                                   *
+ *********************************************************************/
+
+/* 
+ * scan_line finds the first '\n' in [p, end), NULL if there is none,
+ * and on the way stores the first ':' before it in *colon unless
+ * *colon is already set, scan_init picks the widest version the cpu
+ * runs before any thread parses
+ */
+
+void scan_init();
+char* scan_scalar(char* p, char* end, char** colon);
+char* scan_sse42(char* p, char* end, char** colon);
+char* scan_avx2(char* p, char* end, char** colon);
+
+extern char* (*scan_line)(char* p, char* end, char** colon);
+
+#endif    /* SCAN_H */
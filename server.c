@@ -1,8 +1,18 @@
+#define _GNU_SOURCE
+
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <poll.h>
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
@@ -10,10 +20,20 @@
 #include <unistd.h>
 
 #include "http.h"
+#include "queue.h"
+#include "rcu.h"
+#include "arena.h"
+#include "pool.h"
+#include "scan.h"
+#include "bundle.h"
 
 #define PORT             "8080"
-#define MAX_NUM_CONNS    1000
-#define MAX_BUF_LEN      1000
+#define MAX_EVENTS       256
+#define MAX_IN_LEN       POOL_MAX       /* largest request, head and body */
+#define MAX_OUT_BATCH    (256 * 1024)   /* stop answering, flush first */
+#define MAX_SEGS         64             /* queued pieces of responses */
+#define MAX_NUM_CONNS    16384     /* live connections per reactor */
+#define QUEUE_LEN        4096      /* accepted fds awaiting a worker */
 
 /*********************************************************************
  *                                                                   *
@@ -21,16 +41,87 @@
  *                                                                   *
  *********************************************************************/
 
+/**************
+ * conn_state *
+ **************/
+
+/* where a connection is in its read -> respond -> write cycle */
+
+enum conn_state {
+    CONN_READ,
+    CONN_WRITE,
+    CONN_CLOSE
+};
+
+/************
+ * seg_type *
+ ************/
+
+enum seg_type {
+    SEG_BUF,                           /* bytes in the conn's out buf */
+    SEG_FILE,                          /* a range of a file, sendfile'd */
+    SEG_MEM                            /* a range of a version's data */
+};
+
+/*******
+ * seg *
+ *******/
+
+/* a piece of queued output, pipelined responses are a run of these */
+
+struct seg {
+    enum seg_type type;
+    int fd;
+    off_t off;                         /* into out buf, file or data */
+    size_t len;
+    struct file* file;                 /* pinned version backing fd */
+};
+
 /********
  * conn *
  ********/
 
-/* data associated with a connection */
+/* data associated with a connection, recycled through a free list */
 
 struct conn {
+    struct conn* next;                 /* free list link */
+    struct reactor* reactor;
+    enum conn_state state;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    int fd;
+    int closing;                       /* hang up once out is flushed */
+
+    struct buf in;                     /* bytes received, not yet answered */
+    struct request req;                /* parser state for in */
+    struct arena arena;                /* per request scratch memory */
+
+    struct buf out;                    /* headers and small bodies */
+    struct seg segs[MAX_SEGS];         /* what to send, in order */
+    int n_segs, seg_head;
+};
+
+/***********
+ * reactor *
+ ***********/
+
+/*
+ * an event loop pinned to one cpu, it either owns a SO_REUSEPORT
+ * listener or is woken through wake_fd to drain the accept queue
+ */
+
+struct reactor {
     pthread_t thr;
-    struct sockaddr addr;
-    int fd, addrlen;
+    int id;
+    int listen_fd;
+    int wake_fd;
+    int epoll_fd;
+
+    struct conn* free_conns;           /* closed conns ready for reuse */
+    int n_conns;                       /* conns allocated, live or free */
+    struct pool pool;                  /* in and out bufs of its conns */
+
+    struct rcu_reader rcu;             /* offline while in epoll_wait */
 };
 
 /*********************************************************************
@@ -41,10 +132,15 @@ struct conn {
 
 // global state for server, use unix socket struct as addr field for conn
 
-int n_conns;
-struct conn conns[MAX_NUM_CONNS];
+int n_reactors;
+struct reactor* reactors;
+
+/* queue mode: one acceptor thread feeds accepted fds to the reactors */
+
+int queue_mode;
+int acceptor_fd;
+struct queue accept_queue;
 
-int server_fd;
 struct sockaddr server;
 socklen_t server_len;
 
@@ -58,30 +154,79 @@ socklen_t server_len;
  * server_init *
  ***************/
 
-/* initialize (global) server context */
+/* initialize (global) server context with n event loops */
 
 void
-server_init()
+server_init(int n)
 {
-    n_conns = 0;
-    memset(conns, 0, MAX_NUM_CONNS * sizeof(struct conn));
-    server_fd = 0;
+    n_reactors = n;
+    reactors = calloc(n, sizeof(struct reactor));
+    if (reactors == NULL) {
+        fprintf(stderr, "[ERROR] calloc: %s\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    for (int i = 0; i < n; i++) {
+        reactors[i].id = i;
+        reactors[i].listen_fd = -1;
+        reactors[i].wake_fd = -1;
+        reactors[i].epoll_fd = -1;
+        reactors[i].free_conns = NULL;
+        reactors[i].n_conns = 0;
+    }
+
+    queue_mode = 0;
+    acceptor_fd = -1;
+
     memset(&server, 0, sizeof(struct sockaddr));
     server_len = 0;
 }
 
+/*****************
+ * server_listen *
+ *****************/
+
+/*
+ * opens a non-blocking listener on addr, SO_REUSEPORT lets every
+ * reactor bind the same port and the kernel spreads accepts over them
+ */
+
+int
+server_listen(struct sockaddr* addr, socklen_t addrlen)
+{
+    int fd, on;
+
+    fd = socket(addr->sa_family, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (fd == -1)
+        return -1;
+
+    on = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+        bind(fd, addr, addrlen) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
 /**************
  * server_gai *
  **************/
 
-void
+/* resolves the server address and returns the first listener on it */
+
+int
 server_gai()
 {
-    int status;
+    int status, fd;
     struct addrinfo hints, *res, *p;
-    
-    memset(&hints, 0, sizeof(struct addrinfo)); 
-    hints.ai_family = AF_INET;     
+
+    memset(&hints, 0, sizeof(struct addrinfo));
+    hints.ai_family = AF_INET;
     hints.ai_socktype = SOCK_STREAM;
     hints.ai_flags = AI_PASSIVE;
 
@@ -92,21 +237,13 @@ server_gai()
         exit(EXIT_FAILURE);
     }
 
-    /* take the very last matching addrinfo */
+    /* take the first addrinfo we can listen on */
 
+    fd = -1;
     for (p = res; p != NULL; p = p->ai_next) {
-        
-        server_fd = socket(p->ai_family, p->ai_socktype, p->ai_protocol);
-        if (server_fd == -1)
-            continue;
-        
-        status = bind(server_fd, p->ai_addr, p->ai_addrlen);
-        if (status < 0) {
-            close(server_fd);
-            continue;
-        }
-
-        break;
+        fd = server_listen(p->ai_addr, p->ai_addrlen);
+        if (fd != -1)
+            break;
     }
 
     if (p == NULL) {
@@ -121,6 +258,67 @@ server_gai()
     freeaddrinfo(res);
 
     printf("[SERVER] Starting ... OK\n");
+
+    return fd;
+}
+
+/****************
+ * reactor_init *
+ ****************/
+
+/*
+ * gives a reactor its epoll set plus either a listener or, in queue
+ * mode, an eventfd the acceptor pokes when it hands over connections
+ */
+
+int
+reactor_init(struct reactor* reactor)
+{
+    struct epoll_event ev;
+
+    if (rcu_register(&reactor->rcu) < 0) {
+        fprintf(stderr, "[ERROR] reactor %d, too many rcu readers\n",
+                reactor->id);
+        return -1;
+    }
+
+    reactor->epoll_fd = epoll_create1(0);
+
+    if (reactor->epoll_fd < 0) {
+        fprintf(stderr, "[ERROR] epoll_create1: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (queue_mode) {
+        reactor->wake_fd = eventfd(0, EFD_NONBLOCK);
+        if (reactor->wake_fd == -1) {
+            fprintf(stderr, "[ERROR] eventfd: %s\n", strerror(errno));
+            return -1;
+        }
+
+        /* the reactor itself marks its wake fd */
+
+        ev.events = EPOLLIN | EPOLLET;
+        ev.data.ptr = reactor;
+
+        return epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->wake_fd, &ev);
+    }
+
+    if (reactor->listen_fd == -1) {
+        reactor->listen_fd = server_listen(&server, server_len);
+        if (reactor->listen_fd == -1) {
+            fprintf(stderr, "[ERROR] reactor %d, listen: %s\n",
+                    reactor->id, strerror(errno));
+            return -1;
+        }
+    }
+
+    /* a NULL pointer marks the listening socket */
+
+    ev.events = EPOLLIN | EPOLLET;
+    ev.data.ptr = NULL;
+
+    return epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, reactor->listen_fd, &ev);
 }
 
 /*************
@@ -131,95 +329,731 @@ server_gai()
 
 void
 conn_init(struct conn* conn, int fd, struct sockaddr* addr, socklen_t addrlen) {
-    conn->thr = 0;
+    conn->state = CONN_READ;
     conn->fd = fd;
-    memcpy(&conn->addr, addr, addrlen);
+    conn->closing = 0;
+    if (addrlen > 0)
+        memcpy(&conn->addr, addr, addrlen);
     conn->addrlen = addrlen;
+    memset(&conn->arena, 0, sizeof(struct arena));
+    request_init(&conn->req, &conn->arena);
+    memset(&conn->in, 0, sizeof(struct buf));
+    memset(&conn->out, 0, sizeof(struct buf));
+    conn->in.pool = &conn->reactor->pool;
+    conn->out.pool = &conn->reactor->pool;
+    conn->n_segs = 0;
+    conn->seg_head = 0;
 }
 
 /*********************************************************************
  *                                                                   *
- *                       concurrent functions                        *
+ *                        connection handling                        *
  *                                                                   *
  *********************************************************************/
 
+/**************
+ * conn_close *
+ **************/
+
+/*
+ * closing the fd also drops it from the epoll set, the struct goes
+ * back on its reactor's free list instead of to the allocator
+ */
+
+void
+conn_close(struct conn* conn)
+{
+    struct reactor* reactor;
+
+    reactor = conn->reactor;
+
+    for (int i = conn->seg_head; i < conn->n_segs; i++) {
+        if (conn->segs[i].file != NULL)
+            file_put(conn->segs[i].file);
+    }
+
+    close(conn->fd);
+    buf_free(&conn->in);
+    buf_free(&conn->out);
+    request_free(&conn->req);
+    arena_free(&conn->arena);
+
+    conn->next = reactor->free_conns;
+    reactor->free_conns = conn;
+}
+
+/**************
+ * conn_alloc *
+ **************/
+
+/* reuses a closed conn when possible, NULL once the pool is exhausted */
+
+struct conn*
+conn_alloc(struct reactor* reactor)
+{
+    struct conn* conn;
+
+    conn = reactor->free_conns;
+
+    if (conn != NULL) {
+        reactor->free_conns = conn->next;
+        return conn;
+    }
+
+    if (reactor->n_conns >= MAX_NUM_CONNS)
+        return NULL;
+
+    conn = malloc(sizeof(struct conn));
+    if (conn == NULL)
+        return NULL;
+
+    conn->reactor = reactor;
+    reactor->n_conns++;
+
+    return conn;
+}
+
+/*************
+ * conn_read *
+ *************/
+
+/* reads once into the free tail of the input buffer */
+
+int
+conn_read(struct conn* conn)
+{
+    int n_bytes;
+
+    /* start at the smallest class, move up one each time it fills */
+
+    if (conn->in.len == conn->in.cap && buf_reserve(&conn->in, 1) < 0) {
+        fprintf(stderr, "[ERROR] client %d, out of memory\n", conn->fd);
+        conn->state = CONN_CLOSE;
+        return 0;
+    }
+
+    n_bytes = recv(conn->fd, conn->in.data + conn->in.len,
+                   conn->in.cap - conn->in.len, 0);
+
+    if (n_bytes < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) {
+            /* idle, an empty buf goes back to the pool */
+            if (conn->in.len == 0)
+                buf_free(&conn->in);
+            return -1;
+        }
+
+        fprintf(stderr, "[ERROR] client %d, recv: %s\n",
+                conn->fd, strerror(errno));
+        conn->state = CONN_CLOSE;
+        return 0;
+    }
+
+    if (n_bytes == 0) {
+        /* client connection ended */
+        conn->state = CONN_CLOSE;
+        return 0;
+    }
+
+    conn->in.len += n_bytes;
+    return n_bytes;
+}
+
+/************
+ * seg_push *
+ ************/
+
+/*
+ * queues output, runs of out buf bytes collapse into a single seg,
+ * a file seg takes over the caller's ref on file
+ */
+
+void
+seg_push(struct conn* conn, enum seg_type type, int fd, off_t off, size_t len,
+         struct file* file)
+{
+    struct seg* seg;
+
+    if (len == 0) {
+        if (file != NULL)
+            file_put(file);
+        return;
+    }
+
+    if (conn->n_segs > 0) {
+        seg = &conn->segs[conn->n_segs - 1];
+        if (type == SEG_BUF && seg->type == SEG_BUF &&
+            seg->off + (off_t)seg->len == off) {
+            seg->len += len;
+            return;
+        }
+    }
+
+    seg = &conn->segs[conn->n_segs++];
+    seg->type = type;
+    seg->fd = fd;
+    seg->off = off;
+    seg->len = len;
+    seg->file = file;
+}
+
+/*************
+ * part_push *
+ *************/
+
+/*
+ * queues one piece of a body, big stretches of a file with a descriptor
+ * go out by sendfile, of a bundled one straight from its data, and the
+ * rest is copied into out, -1 if out has no room, a mapped file is
+ * never copied from since a page truncated under it would fault
+ */
+
+int
+part_push(struct conn* conn, struct file* file, struct part* part)
+{
+    char* src;
+    int off;
+
+    if (part->data == NULL && file->fd >= 0 &&
+        (part->len >= SENDFILE_MIN || file->map_len)) {
+        file_ref(file);
+        seg_push(conn, SEG_FILE, file->fd, file->fd_off + part->off,
+                 part->len, file);
+        return 0;
+    }
+
+    if (part->data == NULL && file->bundled && part->len >= SENDFILE_MIN) {
+        file_ref(file);
+        seg_push(conn, SEG_MEM, -1, part->off, part->len, file);
+        return 0;
+    }
+
+    src = part->data ? part->data : (char*)file->data + part->off;
+    if (buf_reserve(&conn->out, part->len) < 0)
+        return -1;
+
+    off = conn->out.len;
+    memcpy(conn->out.data + off, src, part->len);
+    conn->out.len += part->len;
+    seg_push(conn, SEG_BUF, -1, off, part->len, NULL);
+
+    return 0;
+}
+
+/****************
+ * conn_process *
+ ****************/
+
+/*
+ * feeds the buffered bytes to the request parser, once a whole request
+ * is in its response is appended to out and its bytes are dropped, a
+ * response that can not be queued whole closes the connection
+ */
+
+int
+conn_process(struct conn* conn)
+{
+    enum parse_result result;
+    struct request* req;
+    struct response resp;
+    int hdr_off;
+
+    if (conn->in.len == 0)
+        return -1;
+
+    req = &conn->req;
+    result = parse_request(req, conn->in.data, conn->in.len);
+
+    if (result == PARSE_AGAIN) {
+        if (conn->in.len < MAX_IN_LEN)
+            return -1;
+
+        /* request will never fit, answer and hang up */
+        req->status = BAD_REQUEST;
+        result = PARSE_ERROR;
+    }
+
+    if (result == PARSE_ERROR) {
+        conn->closing = 1;
+        req->len = conn->in.len;
+    }
+
+    if (!req->keep_alive)
+        conn->closing = 1;
+
+    /* create a response */
+
+    response_init(&resp, &conn->arena);
+    resp.keep_alive = !conn->closing;
+    resp.minor = req->minor;
+
+    if (req->status == OK && req->method == POST) {
+        post_response(&resp, req);
+    } else if (req->status == OK) {
+        route_response(&resp, req);
+    } else {
+        route_error(&resp, req->status);
+    }
+
+    /* serialize the header, the body follows it or comes from a file */
+
+    hdr_off = conn->out.len;
+    if (make_response(&resp, &conn->out) < 0) {
+        if (resp.fd >= 0)
+            file_put(resp.file);
+        goto fail;
+    }
+
+    seg_push(conn, SEG_BUF, -1, hdr_off, conn->out.len - hdr_off, NULL);
+
+    if (resp.fd >= 0)
+        seg_push(conn, SEG_FILE, resp.fd, resp.file->fd_off,
+                 resp.content_len, resp.file);
+
+    for (int i = 0; i < resp.n_parts; i++) {
+        if (part_push(conn, resp.file, &resp.parts[i]) < 0)
+            goto fail;
+    }
+
+    response_free(&resp);
+
+    /* keep whatever the client sent after this request */
+
+    conn->in.len -= req->len;
+    memmove(conn->in.data, conn->in.data + req->len, conn->in.len);
+
+    /* nothing of this request outlives its bytes in out */
+
+    request_free(req);
+    arena_reset(&conn->arena);
+    request_init(req, &conn->arena);
+
+    return 0;
+
+fail:
+    /* a response cut short would desync the stream, hang up instead */
+
+    response_free(&resp);
+    conn->closing = 1;
+    conn->state = CONN_CLOSE;
+    return -1;
+}
+
+/**************
+ * conn_write *
+ **************/
+
+/*
+ * sends as much of the queued output as the socket will take, runs of
+ * buffered segs go out in one gathered write and file segs through
+ * sendfile, so file bodies never pass through user space
+ */
+
+int
+conn_write(struct conn* conn)
+{
+    struct iovec iov[MAX_SEGS];
+    struct msghdr msg;
+    struct seg* seg;
+    ssize_t n_bytes;
+    off_t off;
+    int n_iov, flags;
+
+    while (conn->seg_head < conn->n_segs) {
+        seg = &conn->segs[conn->seg_head];
+
+        if (seg->type == SEG_FILE) {
+            off = seg->off;
+            n_bytes = sendfile(conn->fd, seg->fd, &off, seg->len);
+        } else {
+            n_iov = 0;
+            for (int i = conn->seg_head; i < conn->n_segs; i++) {
+                seg = &conn->segs[i];
+                if (seg->type == SEG_FILE)
+                    break;
+                if (seg->type == SEG_MEM)
+                    iov[n_iov].iov_base = seg->file->data + seg->off;
+                else
+                    iov[n_iov].iov_base = conn->out.data + seg->off;
+                iov[n_iov].iov_len = seg->len;
+                n_iov++;
+            }
+
+            /* hold the tail of the packet for a file body that follows */
+
+            flags = MSG_NOSIGNAL;
+            if (conn->seg_head + n_iov < conn->n_segs)
+                flags |= MSG_MORE;
+
+            memset(&msg, 0, sizeof(struct msghdr));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = n_iov;
+            n_bytes = sendmsg(conn->fd, &msg, flags);
+        }
+
+        if (n_bytes < 0) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return -1;
+
+            fprintf(stderr, "[ERROR] client %d, send: %s\n",
+                    conn->fd, strerror(errno));
+            conn->state = CONN_CLOSE;
+            return 0;
+        }
+
+        if (n_bytes == 0) {
+            /* file shrank under us, the length we promised is a lie */
+            conn->state = CONN_CLOSE;
+            return 0;
+        }
+
+        /* retire whatever went out */
+
+        while (n_bytes > 0) {
+            seg = &conn->segs[conn->seg_head];
+            if ((size_t)n_bytes >= seg->len) {
+                n_bytes -= seg->len;
+                if (seg->file != NULL)
+                    file_put(seg->file);
+                conn->seg_head++;
+            } else {
+                seg->off += n_bytes;
+                seg->len -= n_bytes;
+                n_bytes = 0;
+            }
+        }
+    }
+
+    /* flushed, the buf goes back to the pool until there is more */
+
+    buf_free(&conn->out);
+    conn->n_segs = 0;
+    conn->seg_head = 0;
+    conn->state = conn->closing ? CONN_CLOSE : CONN_READ;
+
+    return 0;
+}
+
 /***************
  * handle_conn *
  ***************/
 
-/* handles the connection in a loop */
+/*
+ * drives the connection state machine until the socket would block,
+ * edge triggered epoll only wakes us again once there is new work
+ */
 
-void*
-handle_conn(void* arg)
+void
+handle_conn(struct conn* conn)
 {
-    int n_bytes, status;
+    int status;
+
+    while (conn->state != CONN_CLOSE) {
+        if (conn->state == CONN_WRITE) {
+            status = conn_write(conn);
+            if (status < 0)
+                return;
+            continue;
+        }
+
+        /* answer every pipelined request there is room to queue */
+
+        while (!conn->closing && conn->out.len < MAX_OUT_BATCH &&
+               conn->n_segs + MAX_PARTS + 1 <= MAX_SEGS) {
+            if (conn_process(conn) < 0)
+                break;
+        }
+
+        if (conn->state == CONN_CLOSE)
+            break;
+
+        if (conn->n_segs > 0) {
+            conn->state = CONN_WRITE;
+            continue;
+        }
+
+        status = conn_read(conn);
+        if (status < 0)
+            return;
+    }
+
+    conn_close(conn);
+}
+
+/*************
+ * conn_open *
+ *************/
+
+/* takes ownership of a freshly accepted socket on this reactor */
+
+void
+conn_open(struct reactor* reactor, int fd, struct sockaddr* addr,
+          socklen_t addrlen)
+{
+    int status;
+    struct epoll_event ev;
     struct conn* conn;
-    char buf[MAX_BUF_LEN];
-    struct request req;
-    struct response resp;
 
-    conn = arg;
+    conn = conn_alloc(reactor);
+    if (conn == NULL) {
+        close(fd);
+        return;
+    }
+
+    conn_init(conn, fd, addr, addrlen);
+
+    ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    ev.data.ptr = conn;
+
+    status = epoll_ctl(reactor->epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+
+    if (status < 0) {
+        fprintf(stderr, "[ERROR] epoll_ctl: %s\n", strerror(errno));
+        conn_close(conn);
+        return;
+    }
+
+    /* data may already be waiting on the new socket */
+    handle_conn(conn);
+}
+
+/*****************
+ * handle_accept *
+ *****************/
+
+/* accepts every pending connection on the listening socket */
+
+void
+handle_accept(struct reactor* reactor)
+{
+    int conn_fd;
+    struct sockaddr_storage client;
+    socklen_t client_len;
 
     while (1) {
-        char* msg;
-        int msg_len;
+        client_len = sizeof(struct sockaddr_storage);
+        conn_fd = accept4(reactor->listen_fd, (struct sockaddr*)&client,
+                          &client_len, SOCK_NONBLOCK);
 
-        n_bytes = recv(conn->fd, buf, MAX_BUF_LEN, 0);
-        
-        if (n_bytes == 0) {
-            /* client connection ended */
-            return NULL;
+        if (conn_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return;
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            fprintf(stderr, "[ERROR] accept: %s\n", strerror(errno));
+            return;
         }
 
-        if (n_bytes < 0) {
-            fprintf(stderr, "[ERROR] client %d, recv: %s\n", 
-                    conn->fd, strerror(errno));
+        conn_open(reactor, conn_fd, (struct sockaddr*)&client, client_len);
+    }
+}
+
+/***************
+ * handle_wake *
+ ***************/
+
+/* drains the shared accept queue after the acceptor pokes us */
+
+void
+handle_wake(struct reactor* reactor)
+{
+    int conn_fd;
+    uint64_t n;
+
+    while (read(reactor->wake_fd, &n, sizeof(uint64_t)) > 0)
+        ;
+
+    while (queue_pop(&accept_queue, &conn_fd) == 0)
+        conn_open(reactor, conn_fd, NULL, 0);
+}
+
+/***************
+ * reactor_run *
+ ***************/
+
+/* the event loop, one per worker thread */
+
+void*
+reactor_run(void* arg)
+{
+    int n_events;
+    struct reactor* reactor;
+    struct epoll_event events[MAX_EVENTS];
+
+    reactor = arg;
+
+    while (1) {
+        /* no page versions are held while blocked */
+
+        rcu_offline(&reactor->rcu);
+        n_events = epoll_wait(reactor->epoll_fd, events, MAX_EVENTS, -1);
+        rcu_online(&reactor->rcu);
+
+        if (n_events < 0) {
+            if (errno == EINTR)
+                continue;
+
+            fprintf(stderr, "[ERROR] epoll_wait: %s\n", strerror(errno));
             return (void*)EXIT_FAILURE;
         }
 
-        /* ASSUMING n_bytes < MAX_BUF_LEN */
-        buf[n_bytes] = 0;
+        for (int i = 0; i < n_events; i++) {
+            struct conn* conn;
 
-        printf("\nrecieved from client %d:\n%s\n\n", conn->fd, buf);
+            conn = events[i].data.ptr;
 
-        /* create request*/
-        request_init(&req);
-        status = parse_request(&req, buf);
-        
-        /* create a response */
+            if (conn == NULL) {
+                handle_accept(reactor);
+                continue;
+            }
 
-        response_init(&resp);
+            if ((void*)conn == reactor) {
+                handle_wake(reactor);
+                continue;
+            }
 
-        if (status == 0) {
-            
-            if (req.method == POST) {
-                char *html, *res;
-                html = (char*)view[0].file.data;
-                handle_post(&req, html, &res);
-                free(html);
-                view[0].file.data = (uint8_t*)res;                
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                conn_close(conn);
+                continue;
             }
-            printf("%s\n", view[0].file.data);
-            route_response(&resp, &req);
-        } else {
-            route_error(&resp, status);           
+
+            handle_conn(conn);
         }
-        
-        /* serialize response into text */
-        make_response(&resp, &msg, &msg_len);
+    }
 
-        n_bytes = send(conn->fd, msg, msg_len, 0);
+    return NULL;
+}
 
-        if (n_bytes < 0) {
-            fprintf(stderr, "[ERROR] client %d, send: %s\n", 
-                    conn->fd, strerror(errno));
-            return (void*)EXIT_FAILURE;
-        }
+/*****************
+ * reactor_start *
+ *****************/
+
+/* spawns the reactor thread pinned to its own cpu */
 
-        free(msg);
-    }   
+int
+reactor_start(struct reactor* reactor, int n_cpus)
+{
+    int status;
+    cpu_set_t cpus;
+    pthread_attr_t attr;
+
+    pthread_attr_init(&attr);
+
+    CPU_ZERO(&cpus);
+    CPU_SET(reactor->id % n_cpus, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
+
+    status = pthread_create(&reactor->thr, &attr, reactor_run, reactor);
+    pthread_attr_destroy(&attr);
+
+    if (status != 0) {
+        fprintf(stderr, "[ERROR] pthread_create: %s\n", strerror(status));
+        return -1;
+    }
+
+    return 0;
+}
+
+/***************
+ * date_ticker *
+ ***************/
+
+/* refreshes the shared Date value just after every second boundary */
+
+void*
+date_ticker(void* arg)
+{
+    struct timespec now, next;
+
+    (void)arg;
+
+    while (1) {
+        date_update();
+
+        clock_gettime(CLOCK_REALTIME, &now);
+        next.tv_sec = now.tv_sec + 1;
+        next.tv_nsec = 0;
+
+        while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &next, NULL))
+            ;
+    }
+
+    return NULL;
+}
+
+/***************
+ * view_reload *
+ ***************/
+
+/* hot reloads pages and frees the versions they replace */
+
+void*
+view_reload(void* arg)
+{
+    (void)arg;
+
+    /* a bundle is fixed, there is nothing on disk to watch */
+
+    if (bundle.data == NULL && view_watch() < 0)
+        fprintf(stderr, "[ERROR] hot reload is off\n");
+
+    /* versions replaced by a reload still need freeing */
+
+    while (1) {
+        sleep(1);
+        view_reclaim();
+    }
+
+    return NULL;
 }
 
+/****************
+ * acceptor_run *
+ ****************/
+
+/*
+ * queue mode accept loop, hands each socket to the bounded worker pool
+ * through the lock-free queue and wakes the reactors round robin
+ */
+
+void
+acceptor_run()
+{
+    int conn_fd, next;
+    uint64_t one;
+    struct pollfd pfd;
+
+    pfd.fd = acceptor_fd;
+    pfd.events = POLLIN;
+    next = 0;
+    one = 1;
+
+    while (1) {
+        conn_fd = accept4(acceptor_fd, NULL, NULL, SOCK_NONBLOCK);
+
+        if (conn_fd == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                poll(&pfd, 1, -1);
+                continue;
+            }
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+
+            fprintf(stderr, "[ERROR] accept: %s\n", strerror(errno));
+            return;
+        }
+
+        if (queue_push(&accept_queue, conn_fd) < 0) {
+            /* every worker is backed up, shed the connection */
+            close(conn_fd);
+            continue;
+        }
+
+        write(reactors[next].wake_fd, &one, sizeof(uint64_t));
+        next = (next + 1) % n_reactors;
+    }
+}
 
 /*********************************************************************
  *                                                                   *
@@ -227,76 +1061,183 @@ handle_conn(void* arg)
  *                                                                   *
  *********************************************************************/
 
+/*********
+ * usage *
+ *********/
+
+void
+usage(char* prog)
+{
+    fprintf(stderr, "usage: %s [-t threads] [-q] [-d] [-H] [-m cache MB]\n"
+                    "       [-b bundle | -p bundle | -e source.c]\n", prog);
+    exit(EXIT_FAILURE);
+}
+
 /********
  * main *
  ********/
 
 int
-main()
+main(int argc, char** argv)
 {
-    int status, conn_fd;
-    struct sockaddr_storage* client;
-    socklen_t client_len;
+    int status, opt, n_cpus, n_threads, use_queue, discover, fd;
+    char *bundle_path, *pack_path, *embed_path;
+    pthread_t ticker, watcher;
+
+    n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (n_cpus < 1)
+        n_cpus = 1;
+
+    /* one reactor per online cpu unless told otherwise */
+
+    n_threads = n_cpus;
+    use_queue = 0;
+    discover = 0;
+    bundle_path = NULL;
+    pack_path = NULL;
+    embed_path = NULL;
+
+    while ((opt = getopt(argc, argv, "t:qdHm:b:p:e:")) != -1) {
+        switch (opt) {
+            case 't':
+                n_threads = atoi(optarg);
+                if (n_threads < 1)
+                    usage(argv[0]);
+                break;
+            case 'q':
+                use_queue = 1;
+                break;
+            case 'd':
+                discover = 1;
+                break;
+            case 'H':
+                view_huge = 1;
+                break;
+            case 'm':
+                view_budget = atol(optarg) * 1024 * 1024;
+                if (view_budget < 1)
+                    usage(argv[0]);
+                break;
+            case 'b':
+                bundle_path = optarg;
+                break;
+            case 'p':
+                pack_path = optarg;
+                break;
+            case 'e':
+                embed_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
 
     /* initialize data */
 
-    server_init();
-    status = view_init();
-    if (status < 0) {
-        fprintf(stderr, "[ERROR] view_init");
+    signal(SIGPIPE, SIG_IGN);
+
+    server_init(n_threads);
+
+    /* serve the whole pages tree instead of the hardcoded routes */
+
+    if (discover && !bundle_path && view_discover() < 0) {
+        fprintf(stderr, "[ERROR] view_discover\n");
         exit(EXIT_FAILURE);
     }
-    server_gai();
 
-    client_len = 0;
-    client = NULL;
+    /* packing is a build step, the server exits once it is written */
+
+    if (pack_path || embed_path) {
+        status = pack_path ? bundle_pack(pack_path) : bundle_embed(embed_path);
+        view_free();
+        exit(status < 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
+    if (bundle_path && bundle_open(bundle_path) < 0)
+        exit(EXIT_FAILURE);
+
+#ifdef EMBED
+    /* the pages were compiled in, nothing is read from disk */
 
-    /* listen */
+    if (!bundle_path &&
+        bundle_attach(bundle_embedded, bundle_embedded_len) < 0)
+        exit(EXIT_FAILURE);
+#endif
 
-    status = listen(server_fd, SOMAXCONN);
+    scan_init();
 
+    status = view_init();
     if (status < 0) {
-        close(server_fd);
-        fprintf(stderr, "[ERROR] listen: %s\n", strerror(errno));
+        fprintf(stderr, "[ERROR] view_init\n");
         exit(EXIT_FAILURE);
     }
+    fd = server_gai();
+
+    if (use_queue) {
+        queue_mode = 1;
+        acceptor_fd = fd;
+        if (queue_init(&accept_queue, QUEUE_LEN) < 0) {
+            fprintf(stderr, "[ERROR] queue_init\n");
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        reactors[0].listen_fd = fd;
+    }
 
-    printf("[SERVER] listening ... OK\n");
+    for (int i = 0; i < n_reactors; i++) {
+        status = reactor_init(&reactors[i]);
+        if (status < 0)
+            exit(EXIT_FAILURE);
+    }
 
-    /* connection accept loop */
+    printf("[SERVER] listening on %d threads ... OK\n", n_reactors);
 
-    while (1) {
-        struct conn* conn;
+    /* page watcher, Date header clock, then the event loops */
 
-        if (n_conns >= MAX_NUM_CONNS)
-            break;
-
-        conn_fd = accept(server_fd, (struct sockaddr*)&client, &server_len);
+    status = pthread_create(&watcher, NULL, view_reload, NULL);
+    if (status != 0) {
+        fprintf(stderr, "[ERROR] pthread_create: %s\n", strerror(status));
+        exit(EXIT_FAILURE);
+    }
 
-        if (conn_fd == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK)
-                continue;
+    date_update();
+    status = pthread_create(&ticker, NULL, date_ticker, NULL);
+    if (status != 0) {
+        fprintf(stderr, "[ERROR] pthread_create: %s\n", strerror(status));
+        exit(EXIT_FAILURE);
+    }
 
-            fprintf(stderr, "[ERROR] accept: %s\n", strerror(errno));
-            break;
-        }
+    for (int i = 0; i < n_reactors; i++) {
+        status = reactor_start(&reactors[i], n_cpus);
+        if (status < 0)
+            exit(EXIT_FAILURE);
+    }
 
-        printf("[SERVER] connected with a client!\n");
+    if (queue_mode)
+        acceptor_run();
 
-        conn = conns + n_conns;
+    for (int i = 0; i < n_reactors; i++)
+        pthread_join(reactors[i].thr, NULL);
 
-        conn_init(conn, conn_fd, (struct sockaddr*)&client, client_len);
-    
-        status = pthread_create(&conn->thr, NULL, handle_conn, (void*)conn);
+    for (int i = 0; i < n_reactors; i++) {
+        struct conn* conn;
 
-        if (status < 0) {
-            fprintf(stderr, "[ERROR] pthread_create: %s\n", strerror(status));
-            break;
+        while ((conn = reactors[i].free_conns) != NULL) {
+            reactors[i].free_conns = conn->next;
+            free(conn);
         }
 
-        n_conns++;
+        close(reactors[i].epoll_fd);
+        close(reactors[i].listen_fd);
+        close(reactors[i].wake_fd);
     }
 
+    if (queue_mode) {
+        close(acceptor_fd);
+        queue_free(&accept_queue);
+    }
+
+    free(reactors);
     view_free();
-    close(server_fd);
-}
\ No newline at end of file
+    bundle_close();
+}
@@ -0,0 +1,191 @@
+#include <pthread.h>
+#include <sched.h>
+#include "queue.c"
+#include "unity.h"
+
+#define N_ITEMS    100000
+
+/*********************************************************************
+ *                                                                   *
+ *                          unity helpers                            *
+ *                                                                   *
+ *********************************************************************/
+
+void 
+setUp() 
+{
+    /* empty */
+}
+
+void 
+tearDown() 
+{
+    /* empty */
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                           basic tests                             *
+ *                                                                   *
+ *********************************************************************/
+
+/*****************
+ * push_pop_fifo *
+ *****************/
+
+void
+push_pop_fifo()
+{
+    struct queue queue;
+    int val;
+
+    TEST_ASSERT_EQUAL_INT(0, queue_init(&queue, 4));
+
+    TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, 1));
+    TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, 2));
+    TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, 3));
+
+    TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(1, val);
+    TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(2, val);
+    TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(3, val);
+
+    queue_free(&queue);
+}
+
+/******************
+ * full_and_empty *
+ ******************/
+
+void
+full_and_empty()
+{
+    struct queue queue;
+    int val;
+
+    TEST_ASSERT_EQUAL_INT(-1, queue_init(&queue, 3));
+    TEST_ASSERT_EQUAL_INT(0, queue_init(&queue, 2));
+
+    TEST_ASSERT_EQUAL_INT(-1, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, 7));
+    TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, 8));
+    TEST_ASSERT_EQUAL_INT(-1, queue_push(&queue, 9));
+
+    /* wrap around the ring a few laps */
+
+    for (int i = 0; i < 10; i++) {
+        TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+        TEST_ASSERT_EQUAL_INT(0, queue_push(&queue, i));
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(8, val);
+    TEST_ASSERT_EQUAL_INT(0, queue_pop(&queue, &val));
+    TEST_ASSERT_EQUAL_INT(9, val);
+    TEST_ASSERT_EQUAL_INT(-1, queue_pop(&queue, &val));
+
+    queue_free(&queue);
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                         concurrent tests                          *
+ *                                                                   *
+ *********************************************************************/
+
+struct queue shared;
+atomic_long popped_sum;
+atomic_int popped_count;
+
+/************
+ * producer *
+ ************/
+
+void*
+producer(void* arg)
+{
+    (void)arg;
+
+    /* full, let a consumer run rather than spin out the timeslice */
+
+    for (int i = 1; i <= N_ITEMS; i++)
+        while (queue_push(&shared, i) < 0)
+            sched_yield();
+
+    return NULL;
+}
+
+/************
+ * consumer *
+ ************/
+
+void*
+consumer(void* arg)
+{
+    int val;
+
+    (void)arg;
+
+    while (atomic_load(&popped_count) < 2 * N_ITEMS) {
+        if (queue_pop(&shared, &val) == 0) {
+            atomic_fetch_add(&popped_sum, val);
+            atomic_fetch_add(&popped_count, 1);
+        } else {
+            sched_yield();
+        }
+    }
+
+    return NULL;
+}
+
+/************************
+ * two_by_two_no_losses *
+ ************************/
+
+void
+two_by_two_no_losses()
+{
+    pthread_t thr[4];
+    long expect;
+
+    TEST_ASSERT_EQUAL_INT(0, queue_init(&shared, 64));
+    atomic_init(&popped_sum, 0);
+    atomic_init(&popped_count, 0);
+
+    pthread_create(&thr[0], NULL, producer, NULL);
+    pthread_create(&thr[1], NULL, producer, NULL);
+    pthread_create(&thr[2], NULL, consumer, NULL);
+    pthread_create(&thr[3], NULL, consumer, NULL);
+
+    for (int i = 0; i < 4; i++)
+        pthread_join(thr[i], NULL);
+
+    expect = 2L * N_ITEMS * (N_ITEMS + 1) / 2;
+
+    TEST_ASSERT_EQUAL_INT(2 * N_ITEMS, atomic_load(&popped_count));
+    TEST_ASSERT_TRUE(expect == atomic_load(&popped_sum));
+
+    queue_free(&shared);
+}
+
+/*********************************************************************
+ *                                                                   *
+ *                              main                                 *
+ *                                                                   *
+ *********************************************************************/
+
+/********
+ * main *
+ ********/
+
+int
+main() 
+{
+    UNITY_BEGIN();
+    RUN_TEST(push_pop_fifo);
+    RUN_TEST(full_and_empty);
+    RUN_TEST(two_by_two_no_losses);
+    return UNITY_END();
+}